@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include "analysis.hpp"
+#include "movegen.hpp"
+
+namespace
+{
+// The number of moves to promote for a pawn that never will
+const unsigned int NEVER = 0xff;
+
+std::array<Bitboard, 64> make_passer_cones();
+unsigned int moves_to_promote(unsigned int bitnum);
+unsigned int fastest_promotion(Bitboard pawns);
+unsigned int fastest_passer(Bitboard pawns, Bitboard enemy_pawns);
+
+// For each square, every square an enemy pawn could be on and still some day block or capture a pawn
+// that's on that square and walking straight up the board. An enemy pawn moves down one rank per move,
+// and can only change files by capturing, so the cone widens by a file for every rank further up it is.
+const std::array<Bitboard, 64> PASSER_CONES = make_passer_cones();
+}
+
+
+// All from the POV of the side to move, who moves first in any race
+StaticBounds analyze_position(const Position& pos)
+{
+    if (count_moves(pos) == 0) {
+        // Stalemate; this covers positions where every pawn on the board is blocked for good
+        return {0, 0};
+    }
+
+    // The same questions for the other side are the same questions asked of the flipped board
+    Bitboard my_pawns = pos.my_pawns;
+    Bitboard their_pawns = pos.their_pawns_only();
+    Bitboard flipped_my_pawns = vflip_bitboard(their_pawns);
+    Bitboard flipped_their_pawns = vflip_bitboard(my_pawns);
+
+    unsigned int my_passer = fastest_passer(my_pawns, their_pawns);
+    unsigned int their_passer = fastest_passer(flipped_my_pawns, flipped_their_pawns);
+
+    // A passer can't be taken and always has a move, so its side can't lose all its pawns or be stalemated.
+    // If it promotes before anything of the other side's could, the other side can't win,
+    // and if the other side also has a passer of its own, it can't be stalemated either.
+    if (my_passer != NEVER && my_passer <= fastest_promotion(flipped_my_pawns)) {
+        return {their_passer == NEVER ? 0 : 1, 1};
+    }
+    if (their_passer != NEVER && their_passer < fastest_promotion(my_pawns)) {
+        return {-1, my_passer == NEVER ? 0 : -1};
+    }
+
+    return {-1, 1};
+}
+
+
+namespace
+{
+
+std::array<Bitboard, 64> make_passer_cones()
+{
+    std::array<Bitboard, 64> cones = {};
+    for (int bitnum = 0; bitnum < 64; ++bitnum) {
+        int row = bitnum / 8;
+        int column = bitnum % 8;
+        for (int other = 0; other < 64; ++other) {
+            int files_away = std::abs(other % 8 - column);
+            if (other / 8 > row + std::max(0, files_away - 1)) {
+                cones[bitnum] |= 1ULL << other;
+            }
+        }
+    }
+    return cones;
+}
+
+
+// Pawns on the first rank can't move, and a pawn on the last rank has already promoted
+unsigned int moves_to_promote(unsigned int bitnum)
+{
+    unsigned int row = bitnum / 8;
+    if (row == 0 || row == 7) {
+        return NEVER;
+    }
+    return 7 - row - (row == 1 ? 1 : 0);        // a pawn on the second rank can advance two squares
+}
+
+
+// A lower bound on how long the pawns need to promote, however the game goes
+unsigned int fastest_promotion(Bitboard pawns)
+{
+    unsigned int fastest = NEVER;
+    for (; pawns; pawns &= pawns - 1) {
+        fastest = std::min(fastest, moves_to_promote(lowest_bitnum(pawns)));
+    }
+    return fastest;
+}
+
+
+// How long the fastest passer needs to promote: a pawn that no enemy pawn can ever reach
+// and that none of its own side's pawns stand in front of
+unsigned int fastest_passer(Bitboard pawns, Bitboard enemy_pawns)
+{
+    unsigned int fastest = NEVER;
+    for (Bitboard remaining = pawns; remaining; remaining &= remaining - 1) {
+        unsigned int bitnum = lowest_bitnum(remaining);
+        Bitboard cone = PASSER_CONES[bitnum];
+        Bitboard file_ahead = cone & (FILE_H << (bitnum % 8));
+        if (!(enemy_pawns & cone) && !(pawns & file_ahead)) {
+            fastest = std::min(fastest, moves_to_promote(bitnum));
+        }
+    }
+    return fastest;
+}
+
+} // anon namespace
@@ -0,0 +1,18 @@
+#ifndef PEASANT_ANALYSIS_HPP
+#define PEASANT_ANALYSIS_HPP
+
+#include "position.hpp"
+
+// Bounds on a position's score that can be seen from the pawns alone, without searching.
+// Like the search's bounds, they're true game-theoretic bounds, so lower_bound == upper_bound is a proof.
+struct StaticBounds
+{
+    int lower_bound;
+    int upper_bound;
+};
+
+// Finds dead positions (the side to move can never move again, so it's a draw) and pawn races
+// that a passed pawn nothing can stop is sure to win
+StaticBounds analyze_position(const Position& pos);
+
+#endif
@@ -0,0 +1,254 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <istream>
+#include <locale>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "batch.hpp"
+#include "fen.hpp"
+#include "hash.hpp"
+#include "null_window.hpp"
+
+namespace
+{
+// How far the reader may get ahead of the workers
+const std::size_t QUEUE_LINES_PER_THREAD = 4;
+
+struct BatchLine
+{
+    std::size_t line_number;
+    std::string fen;
+};
+
+// Lines waiting for a worker. push blocks while it's full and pop while it's empty;
+// once it's closed, push turns everything away and pop drains what's left.
+class LineQueue
+{
+public:
+    explicit LineQueue(std::size_t capacity) : m_capacity(capacity), m_closed(false) {}
+    // Returns false if the queue was closed
+    bool push(BatchLine line);
+    // Returns false once the queue is closed and empty
+    bool pop(BatchLine& line);
+    void close();
+
+private:
+    std::size_t m_capacity;
+    std::mutex m_mutex;
+    std::condition_variable m_not_full;
+    std::condition_variable m_not_empty;
+    std::deque<BatchLine> m_lines;
+    bool m_closed;
+};
+
+void solve_line(const BatchLine& line, const BatchOptions& options, SearchContext& context, std::ostream& json);
+void perft_line(const BatchLine& line, const BatchOptions& options, PerftTable& perft_table, std::ostream& json);
+std::string json_string(const std::string& s);
+double seconds_since(std::chrono::steady_clock::time_point start);
+}
+
+
+// A reader on the calling thread hands lines to the worker threads through a small bounded queue,
+// so results start coming out while the input is still arriving, and a long input isn't held in memory.
+// Each thread keeps its search context, TT and all, from one position to the next;
+// the bounds in a TT are true whatever position they were found under, so they only ever help.
+// Lines are written whole under a lock, in the order the positions finish.
+// A line that can't be parsed gets a line with an "error" field instead of stopping the batch.
+void run_batch(std::istream& in,
+               std::ostream& out,
+               const BatchOptions& options,
+               const Tablebase* tablebase,
+               PerftTable& perft_table)
+{
+    if (options.perft && options.max_depth == INT_MAX) {
+        throw std::runtime_error("Batch perft needs --max-depth");
+    }
+
+    unsigned int num_threads = std::max(options.num_threads, 1u);
+    std::vector<std::unique_ptr<TranspositionTable>> tts;
+    for (unsigned int i = 0; i < (options.shared_tt ? 1 : num_threads); ++i) {
+        tts.push_back(std::make_unique<TranspositionTable>(options.perft ? 0 : options.tt_buckets));
+    }
+    std::vector<std::unique_ptr<SearchContext>> contexts;
+    for (unsigned int i = 0; i < num_threads; ++i) {
+        contexts.push_back(std::make_unique<SearchContext>(SearchContext{*tts[options.shared_tt ? 0 : i], nullptr, tablebase}));
+    }
+    std::mutex out_mutex;
+    LineQueue queue(QUEUE_LINES_PER_THREAD * num_threads);
+
+    // If a worker dies of something worse than a bad line, the queue is closed so the reader stops,
+    // and the first such exception is rethrown once everyone has stopped
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto work = [&](unsigned int thread_index) {
+        try {
+            BatchLine line;
+            while (queue.pop(line)) {
+                std::ostringstream json;
+                json.imbue(std::locale::classic());
+                json << "{\"line\": " << line.line_number << ", \"pos\": " << json_string(line.fen);
+                try {
+                    if (options.perft) {
+                        perft_line(line, options, perft_table, json);
+                    } else {
+                        solve_line(line, options, *contexts[thread_index], json);
+                    }
+                }
+                catch (const std::exception& e) {
+                    json << ", \"error\": " << json_string(e.what());
+                }
+                json << "}\n";
+
+                std::lock_guard<std::mutex> lock(out_mutex);
+                out << json.str() << std::flush;
+            }
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+            queue.close();
+        }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < num_threads; ++i) {
+        threads.emplace_back(work, i);
+    }
+
+    std::string text;
+    for (std::size_t line_number = 1; std::getline(in, text); ++line_number) {
+        std::size_t end = text.find_last_not_of(" \t\r");
+        if (end != std::string::npos && !queue.push({line_number, text.substr(0, end + 1)})) {
+            break;
+        }
+    }
+    queue.close();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+
+namespace
+{
+
+bool LineQueue::push(BatchLine line)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_not_full.wait(lock, [this] { return m_closed || m_lines.size() < m_capacity; });
+    if (m_closed) {
+        return false;
+    }
+    m_lines.push_back(std::move(line));
+    m_not_empty.notify_one();
+    return true;
+}
+
+bool LineQueue::pop(BatchLine& line)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_not_empty.wait(lock, [this] { return m_closed || !m_lines.empty(); });
+    if (m_lines.empty()) {
+        return false;
+    }
+    line = std::move(m_lines.front());
+    m_lines.pop_front();
+    m_not_full.notify_one();
+    return true;
+}
+
+void LineQueue::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+    }
+    m_not_full.notify_all();
+    m_not_empty.notify_all();
+}
+
+
+// Deepens until the score is known or max_depth is reached, as the solver does, and reports the last depth
+void solve_line(const BatchLine& line, const BatchOptions& options, SearchContext& context, std::ostream& json)
+{
+    Position pos = parse_fen(line.fen);
+    PositionHash hash = calc_position_hash(pos);
+    auto start = std::chrono::steady_clock::now();
+    int lower_bound = -1;
+    int upper_bound = 1;
+    int depth = options.start_depth - 1;
+    std::uint64_t num_leaves = 0;
+    int num_probes = 0;
+    Variation pv;
+    while (lower_bound != upper_bound && depth < options.max_depth) {
+        ++depth;
+        int depth_probes;
+        SearchResult result = null_window_search(depth, pos, hash, lower_bound, upper_bound, context, pv, depth_probes);
+        lower_bound = result.lower_bound;
+        upper_bound = result.upper_bound;
+        num_leaves += result.num_leaves;
+        num_probes += depth_probes;
+    }
+
+    std::string pv_string = variation_to_string(pv);
+    if (!pv_string.empty()) {
+        pv_string.pop_back();           // the trailing space
+    }
+    json << ", \"lower_bound\": " << lower_bound
+         << ", \"upper_bound\": " << upper_bound
+         << ", \"depth\": " << depth
+         << ", \"pv\": " << json_string(pv_string)
+         << ", \"leaves\": " << num_leaves
+         << ", \"probes\": " << num_probes
+         << ", \"sec\": " << seconds_since(start);
+}
+
+
+void perft_line(const BatchLine& line, const BatchOptions& options, PerftTable& perft_table, std::ostream& json)
+{
+    Position pos = parse_fen(line.fen);
+    auto start = std::chrono::steady_clock::now();
+    std::uint64_t num_leaves = perft_node(options.max_depth, pos, perft_table);
+    json << ", \"depth\": " << options.max_depth
+         << ", \"leaves\": " << num_leaves
+         << ", \"sec\": " << seconds_since(start);
+}
+
+
+// Quotes s, escaping what JSON needs escaped
+std::string json_string(const std::string& s)
+{
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out += ' ';
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // anon namespace
@@ -0,0 +1,30 @@
+#ifndef PEASANT_BATCH_HPP
+#define PEASANT_BATCH_HPP
+
+#include <climits>
+#include <cstddef>
+#include <iosfwd>
+#include "search.hpp"
+#include "tablebase.hpp"
+#include "tt.hpp"
+
+struct BatchOptions
+{
+    bool perft = false;                 // count leaves to max_depth instead of solving
+    int start_depth = 1;
+    int max_depth = INT_MAX;
+    unsigned int num_threads = 1;
+    bool shared_tt = false;             // one TT for every thread, rather than one each
+    std::size_t tt_buckets = 0x10'0000;
+};
+
+// Analyzes every position in `in`, one per line in parse_fen's format, and writes one JSON line
+// per position to `out` as each one finishes. Blank lines are skipped.
+// Positions are started as they're read, so `in` can be a pipe that's still being written to.
+void run_batch(std::istream& in,
+               std::ostream& out,
+               const BatchOptions& options,
+               const Tablebase* tablebase,
+               PerftTable& perft_table);
+
+#endif
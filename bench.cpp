@@ -0,0 +1,400 @@
+// The benchmark and regression suite: times the move generator, hashing, the TT, perft and fixed-depth solves
+// on a fixed set of positions, checks perft counts and solve results against known values,
+// and writes everything out as JSON. Exits with 1 if any check fails.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/program_options.hpp>
+#include "fen.hpp"
+#include "hash.hpp"
+#include "movegen.hpp"
+#include "null_window.hpp"
+#include "perft_batch.hpp"
+#include "search.hpp"
+#include "tt.hpp"
+
+namespace po = boost::program_options;
+
+namespace
+{
+// Results get XORed in here so the compiler can't throw the work away
+volatile std::uint64_t g_sink;
+
+const std::size_t TT_BUCKETS = 0x10'0000;             // 64 MiB, as in main
+
+// The microbenchmarks run over every position this many plies from these
+const int MICRO_DEPTH = 4;
+const std::string MICRO_POSITIONS[] = {
+    START_POS,
+    "8/XXXXX3/8/8/8/8/ooooo3/8 -",
+};
+
+struct PerftCase
+{
+    std::string fen;
+    int depth;
+    std::uint64_t expected_leaves;
+};
+
+// Checked with --compare-perft, which holds gen_moves to the reference generator
+const PerftCase PERFT_CASES[] = {
+    {START_POS, 7, 6'146'460},
+    {"8/8/XXXXXXXX/XXXXXXXX/oooooooo/oooooooo/8/8 -", 6, 7'116'718},
+    {"8/XXXXX3/8/8/8/8/ooooo3/8 -", 7, 4'039'636},
+    {"8/1XX1X3/3X4/8/2o1o3/8/o1o2o2/8 -", 7, 421'439},
+    {"8/2X5/8/3oX3/8/8/8/8 e6", 6, 18},
+    // Two-square advances on the edge files, next to pawns that can take en passant, so a stray
+    // en passant marker on either side's back rank shows up (counted before the markers existed)
+    {"8/1X4XX/8/6X1/1o6/8/oo5o/8 -", 8, 314'748},
+};
+
+struct SolveCase
+{
+    std::string fen;
+    int depth;
+    int true_score;             // the bounds found must include it
+};
+
+const SolveCase SOLVE_CASES[] = {
+    {"8/XXX5/8/8/8/8/ooo5/8 -", 12, 0},
+    {"8/XXXX4/8/8/8/8/oooo4/8 -", 21, 1},
+    {"8/XXXXX3/8/8/8/8/ooooo3/8 -", 11, 0},
+};
+
+// A position, its hashes, and one of its moves
+struct HashUpdate
+{
+    PositionHash hash;
+    Position pos;
+    Position new_pos;
+};
+
+// Mean and variance over the samples
+struct Timing
+{
+    double mean;
+    double variance;
+};
+
+std::vector<Position> collect_positions();
+void collect_positions(int depth, const Position& pos, std::vector<Position>& positions);
+Timing time_samples(int num_samples, const std::function<double()>& run_sample);
+Timing time_per_op(int num_samples, std::size_t num_ops, const std::function<void()>& run_ops);
+void write_micro(std::ostream& out, const std::string& name, const Timing& ns_per_op, bool is_last);
+bool run_perft_cases(std::ostream& out, int num_samples);
+bool run_solve_cases(std::ostream& out, int num_samples);
+std::uint64_t splitmix(std::uint64_t& state);
+double seconds_since(std::chrono::steady_clock::time_point start);
+}
+
+
+int main(int argc, char *argv[])
+{
+    init_zobrist();
+
+    try {
+        po::options_description desc("Options");
+        desc.add_options()
+            ("help", "Show this message")
+            ("samples", po::value<int>(), "Times to run each benchmark (default 5)")
+            ("out", po::value<std::string>(), "File to write the JSON to (default: standard output)");
+
+        po::variables_map vm;
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+
+        if (vm.count("help")) {
+            std::cout << "Usage: " << argv[0] << " [options]\n";
+            std::cout << desc;
+            return 0;
+        }
+
+        int num_samples = vm.count("samples") ? std::max(1, vm["samples"].as<int>()) : 5;
+        std::ofstream out_file;
+        if (vm.count("out")) {
+            out_file.open(vm["out"].as<std::string>());
+            if (!out_file) {
+                throw std::runtime_error("Can't open " + vm["out"].as<std::string>());
+            }
+        }
+        std::ostream& out = vm.count("out") ? out_file : std::cout;
+
+        std::vector<Position> positions = collect_positions();
+        std::vector<HashUpdate> updates;
+        for (const Position& pos : positions) {
+            MoveList movelist;
+            gen_moves(movelist, pos);
+            for (const SearchMove& move : movelist) {
+                updates.push_back({calc_position_hash(pos), pos, move.new_pos});
+            }
+        }
+
+        out << "{\n  \"samples\": " << num_samples << ",\n";
+        out << "  \"micro\": [\n";
+
+        write_micro(out, "gen_moves", time_per_op(num_samples, positions.size(), [&]() {
+            std::uint64_t sum = 0;
+            for (const Position& pos : positions) {
+                MoveList movelist;
+                gen_moves(movelist, pos);
+                sum += movelist.size();
+            }
+            g_sink ^= sum;
+        }), false);
+
+        write_micro(out, "count_moves", time_per_op(num_samples, positions.size(), [&]() {
+            std::uint64_t sum = 0;
+            for (const Position& pos : positions) {
+                sum += count_moves(pos);
+            }
+            g_sink ^= sum;
+        }), false);
+
+        write_micro(out, "flip_board", time_per_op(num_samples, positions.size(), [&]() {
+            std::uint64_t sum = 0;
+            for (const Position& pos : positions) {
+                sum ^= flip_board(pos).my_pawns;
+            }
+            g_sink ^= sum;
+        }), false);
+
+        write_micro(out, "calc_hash", time_per_op(num_samples, positions.size(), [&]() {
+            std::uint64_t sum = 0;
+            for (const Position& pos : positions) {
+                sum ^= calc_hash(pos);
+            }
+            g_sink ^= sum;
+        }), false);
+
+        // The way the search hashes: each child from its parent
+        write_micro(out, "update_position_hash", time_per_op(num_samples, updates.size(), [&]() {
+            std::uint64_t sum = 0;
+            for (const HashUpdate& update : updates) {
+                sum ^= update_position_hash(update.hash, update.pos, update.new_pos).hash;
+            }
+            g_sink ^= sum;
+        }), false);
+
+        TranspositionTable tt(TT_BUCKETS);
+        const std::size_t num_tt_ops = TT_BUCKETS * TranspositionTable::SLOTS_PER_BUCKET;
+        write_micro(out, "tt_insert", time_per_op(num_samples, num_tt_ops, [&]() {
+            std::uint64_t state = 0;
+            for (std::size_t i = 0; i < num_tt_ops; ++i) {
+                std::uint64_t key = splitmix(state);
+                tt.insert(key, TTEntry(-1, 1, int(key % 32)));
+            }
+        }), false);
+
+        write_micro(out, "tt_fetch", time_per_op(num_samples, num_tt_ops, [&]() {
+            std::uint64_t state = 0;
+            std::uint64_t hits = 0;
+            for (std::size_t i = 0; i < num_tt_ops; ++i) {
+                TTEntry entry;
+                hits += tt.fetch(splitmix(state), entry);
+            }
+            g_sink ^= hits;
+        }), true);
+
+        out << "  ],\n";
+        bool perft_ok = run_perft_cases(out, num_samples);
+        out << ",\n";
+        bool solves_ok = run_solve_cases(out, num_samples);
+        out << ",\n  \"ok\": " << (perft_ok && solves_ok ? "true" : "false") << "\n}\n";
+
+        if (!perft_ok || !solves_ok) {
+            std::cerr << "Some checks failed" << std::endl;
+            return 1;
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << "ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+
+namespace
+{
+
+std::vector<Position> collect_positions()
+{
+    std::vector<Position> positions;
+    for (const std::string& fen : MICRO_POSITIONS) {
+        collect_positions(MICRO_DEPTH, parse_fen(fen), positions);
+    }
+    return positions;
+}
+
+void collect_positions(int depth, const Position& pos, std::vector<Position>& positions)
+{
+    positions.push_back(pos);
+    if (depth == 0) {
+        return;
+    }
+
+    MoveList movelist;
+    gen_moves(movelist, pos);
+    for (const SearchMove& move : movelist) {
+        collect_positions(depth - 1, flip_board(move.new_pos), positions);
+    }
+}
+
+
+// run_sample returns the figure for one sample
+Timing time_samples(int num_samples, const std::function<double()>& run_sample)
+{
+    std::vector<double> samples;
+    for (int i = 0; i < num_samples; ++i) {
+        samples.push_back(run_sample());
+    }
+    double mean = 0;
+    for (double sample : samples) {
+        mean += sample;
+    }
+    mean /= samples.size();
+    double variance = 0;
+    for (double sample : samples) {
+        variance += (sample - mean) * (sample - mean);
+    }
+    variance = samples.size() > 1 ? variance / (samples.size() - 1) : 0;
+    return {mean, variance};
+}
+
+// In nanoseconds per op
+Timing time_per_op(int num_samples, std::size_t num_ops, const std::function<void()>& run_ops)
+{
+    return time_samples(num_samples, [&]() -> double {
+        auto start = std::chrono::steady_clock::now();
+        run_ops();
+        return seconds_since(start) * 1e9 / num_ops;
+    });
+}
+
+void write_micro(std::ostream& out, const std::string& name, const Timing& ns_per_op, bool is_last)
+{
+    out << "    {\"name\": \"" << name << "\""
+        << ", \"ns_per_op\": " << ns_per_op.mean
+        << ", \"variance\": " << ns_per_op.variance
+        << ", \"stddev\": " << std::sqrt(ns_per_op.variance)
+        << "}" << (is_last ? "" : ",") << "\n";
+}
+
+
+// Returns false if any count is wrong
+// Every case is run with each perft kernel
+bool run_perft_cases(std::ostream& out, int num_samples)
+{
+    struct Kernel
+    {
+        std::string name;
+        PerftKernel count;
+    };
+    const Kernel kernels[] = {
+        {"depth-first", perft_node},
+        {std::string("batched-") + leaf_kernel_name(), batched_perft_node},
+    };
+
+    bool all_ok = true;
+    out << "  \"perft\": [\n";
+    for (std::size_t i = 0; i < std::size(PERFT_CASES) * std::size(kernels); ++i) {
+        const PerftCase& perft_case = PERFT_CASES[i / std::size(kernels)];
+        const Kernel& kernel = kernels[i % std::size(kernels)];
+        Position pos = parse_fen(perft_case.fen);
+        PerftTable table(0);
+        std::uint64_t num_leaves = 0;
+        Timing nodes_per_sec = time_samples(num_samples, [&]() -> double {
+            auto start = std::chrono::steady_clock::now();
+            num_leaves = kernel.count(perft_case.depth, pos, table);
+            return num_leaves / seconds_since(start);
+        });
+        bool ok = num_leaves == perft_case.expected_leaves;
+        all_ok = all_ok && ok;
+        out << "    {\"pos\": \"" << perft_case.fen << "\""
+            << ", \"kernel\": \"" << kernel.name << "\""
+            << ", \"depth\": " << perft_case.depth
+            << ", \"leaves\": " << num_leaves
+            << ", \"expected\": " << perft_case.expected_leaves
+            << ", \"ok\": " << (ok ? "true" : "false")
+            << ", \"nodes_per_sec\": " << nodes_per_sec.mean
+            << ", \"variance\": " << nodes_per_sec.variance
+            << "}" << (i + 1 < std::size(PERFT_CASES) * std::size(kernels) ? "," : "") << "\n";
+    }
+    out << "  ]";
+    return all_ok;
+}
+
+// Each sample is an iterative-deepening solve from depth 1 with a fresh TT, as main does it.
+// Returns false if any solve comes up with bounds that exclude the true score.
+bool run_solve_cases(std::ostream& out, int num_samples)
+{
+    bool all_ok = true;
+    out << "  \"solve\": [\n";
+    for (std::size_t i = 0; i < std::size(SOLVE_CASES); ++i) {
+        const SolveCase& solve_case = SOLVE_CASES[i];
+        Position pos = parse_fen(solve_case.fen);
+        SearchResult total;
+        Timing seconds = time_samples(num_samples, [&]() -> double {
+            TranspositionTable tt(TT_BUCKETS);
+            total = {-1, 1, 0};
+            auto start = std::chrono::steady_clock::now();
+            for (int depth = 1; total.lower_bound != total.upper_bound && depth <= solve_case.depth; ++depth) {
+                Variation pv;
+                CutoffStats cutoff_stats;
+                int num_probes;
+                SearchResult result = null_window_search(depth,
+                                                         pos,
+                                                         total.lower_bound,
+                                                         total.upper_bound,
+                                                         tt,
+                                                         nullptr,
+                                                         1,
+                                                         pv,
+                                                         cutoff_stats,
+                                                         nullptr,
+                                                         num_probes);
+                total = {result.lower_bound, result.upper_bound, total.num_leaves + result.num_leaves};
+            }
+            return seconds_since(start);
+        });
+        bool ok = total.lower_bound <= solve_case.true_score && solve_case.true_score <= total.upper_bound;
+        all_ok = all_ok && ok;
+        out << "    {\"pos\": \"" << solve_case.fen << "\""
+            << ", \"depth\": " << solve_case.depth
+            << ", \"lower_bound\": " << total.lower_bound
+            << ", \"upper_bound\": " << total.upper_bound
+            << ", \"ok\": " << (ok ? "true" : "false")
+            << ", \"leaves\": " << total.num_leaves
+            << ", \"sec\": " << seconds.mean
+            << ", \"variance\": " << seconds.variance
+            << ", \"nodes_per_sec\": " << total.num_leaves / seconds.mean
+            << "}" << (i + 1 < std::size(SOLVE_CASES) ? "," : "") << "\n";
+    }
+    out << "  ]";
+    return all_ok;
+}
+
+
+// A fixed stream of well-mixed keys, so every run inserts and fetches the same ones
+std::uint64_t splitmix(std::uint64_t& state)
+{
+    std::uint64_t z = (state += 0x9e37'79b9'7f4a'7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58'476d'1ce4'e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d0'49bb'1331'11ebULL;
+    return z ^ (z >> 31);
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // anon namespace
@@ -3,7 +3,11 @@
 
 Bitboard vflip_bitboard(Bitboard board)
 {
+#ifdef _MSC_VER
     return _byteswap_uint64(board);
+#else
+    return __builtin_bswap64(board);
+#endif
 }
 
 // From https://chessprogramming.wikispaces.com/Flipping+Mirroring+and+Rotating#Rotationby180degrees
@@ -23,3 +27,15 @@ Bitboard rotate_bitboard(Bitboard x)
    x = ( x >> 32)       | ( x       << 32);
    return x;
 }
+
+// Mirrors the board left to right; this is the first half of rotate_bitboard
+Bitboard mirror_bitboard(Bitboard x)
+{
+   const Bitboard h1 = 0x5555'5555'5555'5555ULL;
+   const Bitboard h2 = 0x3333'3333'3333'3333ULL;
+   const Bitboard h4 = 0x0f0f'0f0f'0f0f'0f0fULL;
+   x = ((x >> 1) & h1) | ((x & h1) << 1);
+   x = ((x >> 2) & h2) | ((x & h2) << 2);
+   x = ((x >> 4) & h4) | ((x & h4) << 4);
+   return x;
+}
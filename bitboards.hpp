@@ -5,10 +5,42 @@
 // If the bitboard is oriented from white's POV, the most significant bit is a8.
 
 #include <cstdint>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 typedef std::uint64_t Bitboard;
 
+// Ranks are from the POV of whoever owns the bitboard; files are from white's POV
+constexpr Bitboard RANK_1 = 0x0000'0000'0000'00ffULL;
+constexpr Bitboard RANK_3 = 0x0000'0000'00ff'0000ULL;
+constexpr Bitboard RANK_8 = 0xff00'0000'0000'0000ULL;
+constexpr Bitboard FILE_A = 0x8080'8080'8080'8080ULL;       // leftmost column
+constexpr Bitboard FILE_H = 0x0101'0101'0101'0101ULL;       // rightmost column
+
 Bitboard vflip_bitboard(Bitboard board);
 Bitboard rotate_bitboard(Bitboard bitboard);
+Bitboard mirror_bitboard(Bitboard board);
+
+// board must not be zero
+inline unsigned int lowest_bitnum(Bitboard board)
+{
+#ifdef _MSC_VER
+    unsigned long bitnum;
+    _BitScanForward64(&bitnum, board);
+    return bitnum;
+#else
+    return static_cast<unsigned int>(__builtin_ctzll(board));
+#endif
+}
+
+inline unsigned int popcount(Bitboard board)
+{
+#ifdef _MSC_VER
+    return static_cast<unsigned int>(__popcnt64(board));
+#else
+    return static_cast<unsigned int>(__builtin_popcountll(board));
+#endif
+}
 
 #endif
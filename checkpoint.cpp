@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include "checkpoint.hpp"
+
+namespace
+{
+// Version 2: en passant squares stopped having hash keys of their own, so older tables don't match
+const char MAGIC[8] = {'P', 'E', 'A', 'S', 'C', 'P', '0', '2'};
+
+struct CheckpointHeader
+{
+    char magic[8];
+    std::int32_t depth;
+    std::int32_t lower_bound;
+    std::int32_t upper_bound;
+    std::uint32_t pv_length;
+    std::uint32_t fen_length;
+    std::uint32_t reserved;
+    std::uint64_t num_buckets;
+};
+}
+
+
+// The header is followed by the pv as (source, destination) byte pairs, the fen, and the TT's slots
+void save_checkpoint(const std::string& filename, const SolveState& state, const TranspositionTable& tt)
+{
+    std::string temp = filename + ".tmp";
+    {
+        std::ofstream out(temp, std::ios::binary);
+        CheckpointHeader header = {};
+        std::copy(std::begin(MAGIC), std::end(MAGIC), header.magic);
+        header.depth = state.depth;
+        header.lower_bound = state.lower_bound;
+        header.upper_bound = state.upper_bound;
+        header.pv_length = static_cast<std::uint32_t>(state.pv.size());
+        header.fen_length = static_cast<std::uint32_t>(state.pos_fen.size());
+        header.num_buckets = tt.num_buckets();
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for (const Move& move : state.pv) {
+            char squares[2] = {static_cast<char>(move.src_bitnum), static_cast<char>(move.dest_bitnum)};
+            out.write(squares, 2);
+        }
+        out.write(state.pos_fen.data(), state.pos_fen.size());
+        tt.save(out);
+        out.close();
+        if (!out) {
+            throw std::runtime_error("Can't write checkpoint " + temp);
+        }
+    }
+    std::filesystem::rename(temp, filename);
+}
+
+
+SolveState load_checkpoint(const std::string& filename, TranspositionTable& tt)
+{
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Can't open checkpoint " + filename);
+    }
+    CheckpointHeader header;
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        !std::equal(std::begin(MAGIC), std::end(MAGIC), header.magic) ||
+        header.pv_length > MAX_DEPTH) {
+        throw std::runtime_error("Checkpoint " + filename + " is corrupt");
+    }
+    if (header.num_buckets != tt.num_buckets()) {
+        throw std::runtime_error("Checkpoint " + filename + " has a different size of transposition table");
+    }
+
+    SolveState state;
+    state.depth = header.depth;
+    state.lower_bound = header.lower_bound;
+    state.upper_bound = header.upper_bound;
+    for (std::uint32_t i = 0; i < header.pv_length; ++i) {
+        unsigned char squares[2];
+        in.read(reinterpret_cast<char*>(squares), 2);
+        state.pv.push_back({squares[0], squares[1]});
+    }
+    state.pos_fen.resize(header.fen_length);
+    in.read(state.pos_fen.data(), header.fen_length);
+    if (!in) {
+        throw std::runtime_error("Checkpoint " + filename + " is truncated");
+    }
+    tt.load(in);
+    return state;
+}
+
+
+Checkpointer::Checkpointer(const std::string& filename,
+                           const TranspositionTable& tt,
+                           std::chrono::seconds interval,
+                           const SolveState& state)
+  : m_filename(filename),
+    m_tt(tt),
+    m_interval(interval),
+    m_done(false),
+    m_state(state)
+{
+    m_thread = std::thread([this] {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (!m_wake.wait_for(lock, m_interval, [this] { return m_done; })) {
+            lock.unlock();
+            save();
+            lock.lock();
+        }
+    });
+}
+
+Checkpointer::~Checkpointer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done = true;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+}
+
+void Checkpointer::update(const SolveState& state)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_state = state;
+}
+
+void Checkpointer::save_now()
+{
+    save();
+}
+
+// A failed save is only reported; losing a checkpoint shouldn't lose the run
+void Checkpointer::save()
+{
+    std::lock_guard<std::mutex> save_lock(m_save_mutex);
+    SolveState state;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        state = m_state;
+    }
+    try {
+        save_checkpoint(m_filename, state, m_tt);
+    }
+    catch (const std::exception& e) {
+        std::cerr << "WARNING: " << e.what() << std::endl;
+    }
+}
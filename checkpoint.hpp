@@ -0,0 +1,55 @@
+#ifndef PEASANT_CHECKPOINT_HPP
+#define PEASANT_CHECKPOINT_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "search.hpp"
+#include "tt.hpp"
+
+// Where an iterative-deepening solve had got to: the position, the last depth it finished,
+// and the bounds and pv that depth found
+struct SolveState
+{
+    std::string pos_fen;
+    int depth;
+    int lower_bound;
+    int upper_bound;
+    Variation pv;
+};
+
+// A checkpoint file holds the state and then the whole TT. It's written under a temporary name
+// and renamed into place, so a run killed mid-write leaves the last checkpoint as it was.
+void save_checkpoint(const std::string& filename, const SolveState& state, const TranspositionTable& tt);
+// tt has to be the size the checkpoint was saved from
+SolveState load_checkpoint(const std::string& filename, TranspositionTable& tt);
+
+// Saves a checkpoint every interval on a background thread, while the search carries on.
+// The TT is read as it stands, which is fine since every entry in it is true;
+// the state is whatever update was last given, so a resumed solve redoes the depth that was underway.
+class Checkpointer
+{
+public:
+    Checkpointer(const std::string& filename, const TranspositionTable& tt, std::chrono::seconds interval, const SolveState& state);
+    ~Checkpointer();
+    void update(const SolveState& state);
+    // Saves right away, on the calling thread
+    void save_now();
+
+private:
+    void save();
+
+    std::string m_filename;
+    const TranspositionTable& m_tt;
+    std::chrono::seconds m_interval;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_done;
+    SolveState m_state;
+    std::mutex m_save_mutex;            // one save at a time
+    std::thread m_thread;
+};
+
+#endif
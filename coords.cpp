@@ -1,9 +1,10 @@
+#include <stdexcept>
 #include "coords.hpp"
 
 unsigned int parse_coords(const std::string& coords)
 {
     if (coords.length() != 2) {
-        throw std::exception("Invalid coords");
+        throw std::runtime_error("Invalid coords");
     }
 
     // @TODO@ -- verify they're in range
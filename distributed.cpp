@@ -0,0 +1,452 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "analysis.hpp"
+#include "distributed.hpp"
+#include "fen.hpp"
+#include "hash.hpp"
+#include "movegen.hpp"
+#include "null_window.hpp"
+#include "tt.hpp"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+struct Bounds
+{
+    int lower_bound;
+    int upper_bound;
+};
+
+// Keeps a claim file's modification time fresh on a background thread, so other workers know we're alive
+class ClaimHeartbeat
+{
+public:
+    ClaimHeartbeat(const fs::path& claim, std::chrono::seconds interval);
+    ~ClaimHeartbeat();
+
+private:
+    fs::path m_claim;
+    std::chrono::seconds m_interval;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_done;
+    std::thread m_thread;
+};
+
+Position canonical_position(const Position& pos);
+bool is_frontier(const Position& pos, int plies_left, MoveList& movelist);
+void expand(const Position& pos,
+            int plies_left,
+            std::unordered_set<std::string>& visited,
+            std::unordered_set<std::string>& frontier_set,
+            std::vector<std::string>& frontier);
+Bounds back_up(const Position& pos,
+               int plies_left,
+               const std::unordered_map<std::string, Bounds>& results,
+               std::unordered_map<std::string, Bounds>& memo,
+               std::size_t& num_missing);
+bool try_claim(const fs::path& claim, const std::string& worker_id, int lease_seconds);
+void release_claim(const fs::path& claim, const std::string& worker_id);
+void solve_unit(const fs::path& unit,
+                const fs::path& result,
+                const std::string& worker_id,
+                const WorkerOptions& options,
+                TranspositionTable& tt,
+                const Tablebase* tablebase);
+fs::path manifest_path(const std::string& directory);
+fs::path unit_path(const std::string& directory, std::size_t unit, const std::string& extension);
+std::size_t read_num_units(const std::string& directory, std::string& root_fen, int& num_plies);
+std::string make_worker_id();
+}
+
+
+// Positions that are mirrors of each other, or that are reached by more than one line, are only written once.
+// Expansion stops early where the game ends or the score is plain without searching,
+// and the workers are given those positions too, so that they're found the same way when merging.
+SplitSummary split_work_units(const Position& pos, int num_plies, std::size_t unit_size, const std::string& directory)
+{
+    if (unit_size == 0) {
+        throw std::runtime_error("Work units can't be empty");
+    }
+    fs::create_directories(directory);
+    if (fs::exists(manifest_path(directory))) {
+        throw std::runtime_error(directory + " already holds work units");
+    }
+
+    std::unordered_set<std::string> visited;
+    std::unordered_set<std::string> frontier_set;
+    std::vector<std::string> frontier;
+    expand(pos, num_plies, visited, frontier_set, frontier);
+
+    std::size_t num_units = (frontier.size() + unit_size - 1) / unit_size;
+    for (std::size_t unit = 0; unit < num_units; ++unit) {
+        std::ofstream out(unit_path(directory, unit, ".txt"));
+        std::size_t end = std::min(frontier.size(), (unit + 1) * unit_size);
+        for (std::size_t i = unit * unit_size; i < end; ++i) {
+            out << frontier[i] << "\n";
+        }
+        if (!out) {
+            throw std::runtime_error("Can't write " + unit_path(directory, unit, ".txt").string());
+        }
+    }
+
+    // Written last, so a split that didn't finish can't be worked on
+    std::ofstream manifest(manifest_path(directory));
+    manifest << "pos " << position_to_fen(pos) << "\n"
+             << "plies " << num_plies << "\n"
+             << "units " << num_units << "\n";
+    if (!manifest) {
+        throw std::runtime_error("Can't write " + manifest_path(directory).string());
+    }
+    return {frontier.size(), num_units};
+}
+
+
+// Goes round the units until they all have results. A unit claimed by a live worker is left alone,
+// but it's checked on again, in case that worker dies before finishing it.
+// The TT is kept for the worker's whole life; its bounds are true whichever unit found them.
+void run_worker(const std::string& directory, const WorkerOptions& options, const Tablebase* tablebase, std::ostream& log)
+{
+    std::string root_fen;
+    int num_plies;
+    std::size_t num_units = read_num_units(directory, root_fen, num_plies);
+    std::string worker_id = make_worker_id();
+    TranspositionTable tt(options.tt_buckets);
+
+    for (;;) {
+        bool is_finished = true;
+        bool did_work = false;
+        for (std::size_t unit = 0; unit < num_units; ++unit) {
+            fs::path result = unit_path(directory, unit, ".result");
+            if (fs::exists(result)) {
+                continue;
+            }
+            is_finished = false;
+            fs::path claim = unit_path(directory, unit, ".claim");
+            if (!try_claim(claim, worker_id, options.lease_seconds)) {
+                continue;
+            }
+            if (!fs::exists(result)) {
+                // It may have been finished by a worker whose claim we thought was stale
+                auto before = std::chrono::steady_clock::now();
+                {
+                    ClaimHeartbeat heartbeat(claim, std::chrono::seconds(std::max(1, options.lease_seconds/4)));
+                    solve_unit(unit_path(directory, unit, ".txt"), result, worker_id, options, tt, tablebase);
+                }
+                std::chrono::duration<double> time_taken = std::chrono::steady_clock::now() - before;
+                log << "unit " << unit << " of " << num_units << "; sec " << time_taken.count() << std::endl;
+                did_work = true;
+            }
+            release_claim(claim, worker_id);
+        }
+        if (is_finished) {
+            break;
+        }
+        if (!did_work) {
+            // Everything left is someone else's; wait to see whether they finish
+            std::this_thread::sleep_for(std::chrono::seconds(std::max(1, options.lease_seconds/4)));
+        }
+    }
+}
+
+
+// Redoes the split's expansion, taking the score of each frontier position from the results.
+// Positions without a result yet count as (-1, 1), so the bounds are true but may be loose.
+MergeResult merge_work_results(const std::string& directory)
+{
+    std::string root_fen;
+    int num_plies;
+    std::size_t num_units = read_num_units(directory, root_fen, num_plies);
+
+    std::unordered_map<std::string, Bounds> results;
+    for (std::size_t unit = 0; unit < num_units; ++unit) {
+        std::ifstream in(unit_path(directory, unit, ".result"));
+        int lower_bound;
+        int upper_bound;
+        int depth;
+        std::string fen;
+        while (in >> lower_bound >> upper_bound >> depth && std::getline(in >> std::ws, fen)) {
+            results[fen] = {lower_bound, upper_bound};
+        }
+    }
+
+    std::unordered_map<std::string, Bounds> memo;
+    std::size_t num_missing = 0;
+    Bounds bounds = back_up(parse_fen(root_fen), num_plies, results, memo, num_missing);
+    return {bounds.lower_bound, bounds.upper_bound, num_missing};
+}
+
+
+namespace
+{
+
+ClaimHeartbeat::ClaimHeartbeat(const fs::path& claim, std::chrono::seconds interval)
+  : m_claim(claim),
+    m_interval(interval),
+    m_done(false)
+{
+    m_thread = std::thread([this] {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (!m_wake.wait_for(lock, m_interval, [this] { return m_done; })) {
+            std::error_code ec;
+            fs::last_write_time(m_claim, fs::file_time_type::clock::now(), ec);
+        }
+    });
+}
+
+
+ClaimHeartbeat::~ClaimHeartbeat()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done = true;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+}
+
+
+// A position and its mirror have the same score, so only one of them gets solved: the one with the lower hash
+Position canonical_position(const Position& pos)
+{
+    Position mirrored = mirror_board(pos);
+    return calc_hash(mirrored) < calc_hash(pos) ? mirrored : pos;
+}
+
+
+// If not, movelist gets the position's moves
+bool is_frontier(const Position& pos, int plies_left, MoveList& movelist)
+{
+    if (plies_left <= 0 || !pos.my_pawns || pos.their_pawns & 0x0000'0000'0000'00ffULL) {
+        return true;
+    }
+    StaticBounds static_bounds = analyze_position(pos);
+    if (static_bounds.lower_bound == static_bounds.upper_bound) {
+        return true;
+    }
+    gen_moves(movelist, pos);
+    return movelist.empty();
+}
+
+
+void expand(const Position& pos,
+            int plies_left,
+            std::unordered_set<std::string>& visited,
+            std::unordered_set<std::string>& frontier_set,
+            std::vector<std::string>& frontier)
+{
+    Position canonical = canonical_position(pos);
+    std::string fen = position_to_fen(canonical);
+    if (!visited.insert(fen + " " + std::to_string(plies_left)).second) {
+        return;
+    }
+
+    MoveList movelist;
+    if (is_frontier(canonical, plies_left, movelist)) {
+        if (frontier_set.insert(fen).second) {
+            frontier.push_back(fen);
+        }
+        return;
+    }
+    for (const SearchMove& move : movelist) {
+        expand(flip_board(move.new_pos), plies_left - 1, visited, frontier_set, frontier);
+    }
+}
+
+
+Bounds back_up(const Position& pos,
+               int plies_left,
+               const std::unordered_map<std::string, Bounds>& results,
+               std::unordered_map<std::string, Bounds>& memo,
+               std::size_t& num_missing)
+{
+    Position canonical = canonical_position(pos);
+    std::string fen = position_to_fen(canonical);
+    std::string key = fen + " " + std::to_string(plies_left);
+    auto memo_it = memo.find(key);
+    if (memo_it != memo.end()) {
+        return memo_it->second;
+    }
+
+    Bounds bounds;
+    MoveList movelist;
+    if (is_frontier(canonical, plies_left, movelist)) {
+        auto it = results.find(fen);
+        if (it != results.end()) {
+            bounds = it->second;
+        } else {
+            bounds = {-1, 1};
+            ++num_missing;
+        }
+    } else {
+        bounds = {-1, -1};
+        for (const SearchMove& move : movelist) {
+            Bounds child = back_up(flip_board(move.new_pos), plies_left - 1, results, memo, num_missing);
+            bounds.lower_bound = std::max(bounds.lower_bound, -child.upper_bound);
+            bounds.upper_bound = std::max(bounds.upper_bound, -child.lower_bound);
+        }
+    }
+    memo[key] = bounds;
+    return bounds;
+}
+
+
+// Creating the claim file only succeeds for one worker. If the file is there but stale, it's renamed out
+// of the way first and claimed as usual. That isn't exclusive: two workers that both saw it stale can each
+// rename away whatever claim is there in turn, the other's new one included, and a worker that was only
+// slow, not dead, carries on too. Either way the unit is just solved twice, with the same result.
+bool try_claim(const fs::path& claim, const std::string& worker_id, int lease_seconds)
+{
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        if (std::FILE* file = std::fopen(claim.string().c_str(), "wx")) {
+            std::fputs(worker_id.c_str(), file);
+            std::fclose(file);
+            return true;
+        }
+        if (attempt > 0) {
+            break;
+        }
+        std::error_code ec;
+        fs::file_time_type touched = fs::last_write_time(claim, ec);
+        if (ec || fs::file_time_type::clock::now() - touched < std::chrono::seconds(lease_seconds)) {
+            return false;
+        }
+        fs::path stale = claim;
+        stale += "." + worker_id + ".stale";
+        fs::rename(claim, stale, ec);
+        if (ec) {
+            return false;
+        }
+        fs::remove(stale, ec);
+    }
+    return false;
+}
+
+
+// Leaves the claim alone if it's been taken over since, so we don't drop a successor's claim
+// and have the unit solved a third time. Checking and removing aren't one step, so that can
+// still happen in a narrow window, which only costs the duplicate work.
+void release_claim(const fs::path& claim, const std::string& worker_id)
+{
+    std::string owner;
+    {
+        std::ifstream file(claim);
+        std::getline(file, owner);
+    }
+    if (owner == worker_id) {
+        std::error_code ec;
+        fs::remove(claim, ec);
+    }
+}
+
+
+// Each line of the result is "lower_bound upper_bound depth fen"
+void solve_unit(const fs::path& unit,
+                const fs::path& result,
+                const std::string& worker_id,
+                const WorkerOptions& options,
+                TranspositionTable& tt,
+                const Tablebase* tablebase)
+{
+    std::ifstream in(unit);
+    if (!in) {
+        throw std::runtime_error("Can't read " + unit.string());
+    }
+    fs::path temp = result;
+    temp += "." + worker_id + ".tmp";
+    std::ofstream out(temp);
+
+    std::string fen;
+    while (std::getline(in, fen)) {
+        if (fen.empty()) {
+            continue;
+        }
+        Position pos = parse_fen(fen);
+        int lower_bound = -1;
+        int upper_bound = 1;
+        int depth = options.start_depth - 1;
+        while (lower_bound != upper_bound && depth < options.max_depth) {
+            ++depth;
+            Variation pv;
+            CutoffStats cutoff_stats;
+            int num_probes;
+            SearchResult search_result = null_window_search(depth,
+                                                            pos,
+                                                            lower_bound,
+                                                            upper_bound,
+                                                            tt,
+                                                            tablebase,
+                                                            options.num_threads,
+                                                            pv,
+                                                            cutoff_stats,
+                                                            nullptr,
+                                                            num_probes);
+            lower_bound = search_result.lower_bound;
+            upper_bound = search_result.upper_bound;
+        }
+        out << lower_bound << " " << upper_bound << " " << depth << " " << fen << "\n";
+    }
+
+    out.close();
+    if (!out) {
+        throw std::runtime_error("Can't write " + temp.string());
+    }
+    fs::rename(temp, result);
+}
+
+
+fs::path manifest_path(const std::string& directory)
+{
+    return fs::path(directory) / "manifest.txt";
+}
+
+
+fs::path unit_path(const std::string& directory, std::size_t unit, const std::string& extension)
+{
+    std::ostringstream name;
+    name << "unit_" << std::setw(6) << std::setfill('0') << unit << extension;
+    return fs::path(directory) / name.str();
+}
+
+
+std::size_t read_num_units(const std::string& directory, std::string& root_fen, int& num_plies)
+{
+    std::ifstream in(manifest_path(directory));
+    std::string pos_label;
+    std::string plies_label;
+    std::string units_label;
+    std::size_t num_units;
+    if (!(in >> pos_label >> std::ws && std::getline(in, root_fen) &&
+          in >> plies_label >> num_plies >> units_label >> num_units) ||
+        pos_label != "pos" || plies_label != "plies" || units_label != "units") {
+        throw std::runtime_error("Can't read " + manifest_path(directory).string());
+    }
+    return num_units;
+}
+
+
+// Tells this worker's temporary files and claims apart from everyone else's, on any machine
+std::string make_worker_id()
+{
+    std::random_device random;
+    std::ostringstream id;
+    id << std::hex << std::setw(8) << std::setfill('0') << random() << std::setw(8) << random();
+    return id.str();
+}
+
+} // anon namespace
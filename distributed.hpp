@@ -0,0 +1,50 @@
+#ifndef PEASANT_DISTRIBUTED_HPP
+#define PEASANT_DISTRIBUTED_HPP
+
+#include <climits>
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include "position.hpp"
+#include "tablebase.hpp"
+
+// Solving a position too big for one process, in three steps that share a directory:
+//   split_work_units expands the tree a few plies and writes the distinct positions at the frontier
+//     into numbered work units;
+//   any number of run_worker processes, on this machine or others that see the directory,
+//     claim units one at a time, solve their positions and write a result file for each;
+//   merge_work_results backs the results up to the root by negamax.
+//
+// A worker claims a unit by creating its claim file, and keeps touching it while it works.
+// A claim that hasn't been touched for the lease time belongs to a worker that died,
+// so another worker takes the unit over. Results are written under a temporary name and renamed,
+// so a result file is either complete or missing. The machines' clocks need to roughly agree.
+
+struct SplitSummary
+{
+    std::size_t num_positions;
+    std::size_t num_units;
+};
+
+struct WorkerOptions
+{
+    int start_depth = 1;
+    int max_depth = INT_MAX;
+    unsigned int num_threads = 1;
+    int lease_seconds = 300;
+    std::size_t tt_buckets = 0x10'0000;
+};
+
+struct MergeResult
+{
+    int lower_bound;
+    int upper_bound;
+    std::size_t num_missing;            // frontier positions with no result yet; they count as unknown
+};
+
+SplitSummary split_work_units(const Position& pos, int num_plies, std::size_t unit_size, const std::string& directory);
+// Returns once every unit has a result. Progress goes to log, a line per unit.
+void run_worker(const std::string& directory, const WorkerOptions& options, const Tablebase* tablebase, std::ostream& log);
+MergeResult merge_work_results(const std::string& directory);
+
+#endif
@@ -0,0 +1,491 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <istream>
+#include <locale>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include "coords.hpp"
+#include "engine.hpp"
+#include "fen.hpp"
+#include "hash.hpp"
+#include "movegen.hpp"
+#include "null_window.hpp"
+
+namespace
+{
+typedef std::chrono::steady_clock Clock;
+typedef std::chrono::milliseconds Milliseconds;
+
+// Kept back from every time limit for getting the move to the clock
+const Milliseconds MOVE_OVERHEAD(20);
+// How many more moves the clock has to last, when go doesn't say
+const int DEFAULT_MOVES_TO_GO = 20;
+
+struct GoParams
+{
+    std::optional<Milliseconds> movetime;
+    std::optional<Milliseconds> clock[2];       // [0] is white's, [1] is black's
+    Milliseconds increment[2] = {};
+    int moves_to_go = 0;                        // 0 if not given
+    int max_depth = INT_MAX;
+    bool infinite = false;
+    bool ponder = false;
+};
+
+// soft is when to stop starting new depths; hard is when to stop the search outright.
+// Both count from when the clock started, which for a ponder search is the ponderhit.
+struct TimeBudget
+{
+    bool is_limited;
+    Clock::duration soft;
+    Clock::duration hard;
+};
+
+class Engine
+{
+public:
+    Engine(std::ostream& out, const EngineOptions& options, const Tablebase* tablebase);
+    ~Engine();
+    // Returns false once told to quit
+    bool handle(const std::string& line);
+
+private:
+    void set_position(std::istringstream& args);
+    void go(std::istringstream& args);
+    void ponderhit();
+    void stop_search();
+    void search(int max_depth);
+    void watch_clock();
+    bool has_time_for_depth(Clock::duration last_depth, Clock::duration previous_depth);
+    void write(const std::string& line);
+
+    std::ostream& m_out;
+    std::mutex m_out_mutex;
+    TranspositionTable m_tt;
+    std::atomic<bool> m_stop;
+    SearchContext m_context;            // kept from one search to the next, TT, history and all
+    Position m_pos;
+    bool m_white_to_move;
+
+    // Shared by the command loop, the search thread and the clock thread
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    GoParams m_params;
+    bool m_waiting;                     // the best move is being held until stop or ponderhit
+    bool m_search_done;
+    Clock::time_point m_clock_start;
+    TimeBudget m_budget;
+
+    std::thread m_search_thread;
+    std::thread m_clock_thread;
+};
+
+GoParams parse_go(std::istringstream& args);
+TimeBudget plan_time(const GoParams& params, bool white_to_move);
+Move parse_move(const std::string& text, bool white_to_move);
+std::string move_to_string(const Move& move, bool white_to_move);
+bool is_game_over(const Position& pos);
+Variation line_from_tt(const TranspositionTable& tt, const Position& pos, const PositionHash& hash, int max_length);
+}
+
+
+// Commands are read on the calling thread, so stop and ponderhit get through while the search runs.
+// A command that can't be carried out is answered with "info string ERROR: ..." and otherwise ignored.
+void run_engine(std::istream& in, std::ostream& out, const EngineOptions& options, const Tablebase* tablebase)
+{
+    Engine engine(out, options, tablebase);
+    std::string line;
+    while (std::getline(in, line) && engine.handle(line)) {
+    }
+}
+
+
+namespace
+{
+
+Engine::Engine(std::ostream& out, const EngineOptions& options, const Tablebase* tablebase)
+  : m_out(out),
+    m_tt(options.tt_buckets),
+    m_stop(false),
+    m_context{m_tt, &m_stop, tablebase},
+    m_pos(parse_fen(START_POS)),
+    m_white_to_move(true),
+    m_waiting(false),
+    m_search_done(true),
+    m_budget{false, {}, {}}
+{
+}
+
+Engine::~Engine()
+{
+    stop_search();
+}
+
+bool Engine::handle(const std::string& line)
+{
+    std::istringstream args(line);
+    std::string command;
+    if (!(args >> command)) {
+        return true;
+    }
+    try {
+        if (command == "quit") {
+            stop_search();
+            return false;
+        } else if (command == "isready") {
+            write("readyok");
+        } else if (command == "position") {
+            set_position(args);
+        } else if (command == "go") {
+            go(args);
+        } else if (command == "stop") {
+            stop_search();
+        } else if (command == "ponderhit") {
+            ponderhit();
+        } else {
+            throw std::runtime_error("Unknown command " + command);
+        }
+    }
+    catch (const std::exception& e) {
+        write(std::string("info string ERROR: ") + e.what());
+    }
+    return true;
+}
+
+// The position is only taken once every move has been checked, so a bad one leaves the last position as it was
+void Engine::set_position(std::istringstream& args)
+{
+    stop_search();
+    std::string word;
+    args >> word;
+    Position pos;
+    if (word == "startpos") {
+        pos = parse_fen(START_POS);
+    } else if (word == "fen") {
+        std::string board, en_passant;
+        args >> board >> en_passant;
+        pos = parse_fen(board + " " + en_passant);
+    } else {
+        throw std::runtime_error("position needs startpos or fen");
+    }
+
+    bool white_to_move = true;
+    if (args >> word) {
+        if (word != "moves") {
+            throw std::runtime_error("Expected moves, not " + word);
+        }
+        while (args >> word) {
+            if (is_game_over(pos)) {
+                throw std::runtime_error("The game is already over before " + word);
+            }
+            Move move = parse_move(word, white_to_move);
+            MoveList movelist;
+            gen_moves(movelist, pos);
+            auto it = std::find_if(movelist.begin(), movelist.end(), [&move](const SearchMove& legal_move) {
+                return legal_move.move == move;
+            });
+            if (it == movelist.end()) {
+                throw std::runtime_error("Illegal move " + word);
+            }
+            pos = flip_board(it->new_pos);
+            white_to_move = !white_to_move;
+        }
+    }
+
+    m_pos = pos;
+    m_white_to_move = white_to_move;
+}
+
+// Nothing else is running between stop_search and starting the threads, so nothing needs the lock
+void Engine::go(std::istringstream& args)
+{
+    GoParams params = parse_go(args);
+    stop_search();
+
+    m_stop = false;
+    m_params = params;
+    m_waiting = params.infinite || params.ponder;
+    m_search_done = false;
+    m_clock_start = Clock::now();
+    // A ponder search is on the opponent's time, so the clock doesn't start until ponderhit
+    m_budget = params.ponder ? TimeBudget{false, {}, {}} : plan_time(params, m_white_to_move);
+    m_search_thread = std::thread(&Engine::search, this, params.max_depth);
+    m_clock_thread = std::thread(&Engine::watch_clock, this);
+}
+
+// The search carries on where it was, with whatever the ponder search put in the TT, but now on the clock
+void Engine::ponderhit()
+{
+    if (!m_search_thread.joinable()) {
+        throw std::runtime_error("Not pondering");
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_params.ponder) {
+            throw std::runtime_error("Not pondering");
+        }
+        m_params.ponder = false;
+        m_waiting = m_params.infinite;
+        m_clock_start = Clock::now();
+        m_budget = plan_time(m_params, m_white_to_move);
+    }
+    m_wake.notify_all();
+}
+
+// Stops the search, if there is one, and waits for it to give its move
+void Engine::stop_search()
+{
+    if (!m_search_thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+        m_waiting = false;
+    }
+    m_wake.notify_all();
+    m_search_thread.join();
+    m_clock_thread.join();
+}
+
+// Iterative deepening with null-window probes, as the solver does it, until the position is solved,
+// max_depth is done, the budget runs out or the search is stopped.
+// m_pos and m_white_to_move don't change while a search is running, so they're read without the lock.
+void Engine::search(int max_depth)
+{
+    Clock::time_point start = Clock::now();
+    const Position& pos = m_pos;
+    bool white_to_move = m_white_to_move;
+    PositionHash hash = calc_position_hash(pos);
+    bool game_over = is_game_over(pos);
+
+    int lower_bound = -1;
+    int upper_bound = 1;
+    Variation best_line;
+    std::uint64_t num_leaves = 0;
+    Clock::duration last_depth_time{};
+    Clock::duration previous_depth_time{};
+    for (int depth = 1; !game_over && lower_bound != upper_bound && depth <= max_depth; ++depth) {
+        if (depth > 1 && !has_time_for_depth(last_depth_time, previous_depth_time)) {
+            break;
+        }
+        Clock::time_point depth_start = Clock::now();
+        Variation pv;
+        int num_probes;
+        SearchResult result = null_window_search(depth, pos, hash, lower_bound, upper_bound, m_context, pv, num_probes);
+        num_leaves += result.num_leaves;
+        if (m_context.is_stopped()) {
+            // A depth that was cut short can't be trusted to have found the best line; go with the last one that finished
+            break;
+        }
+        lower_bound = result.lower_bound;
+        upper_bound = result.upper_bound;
+        if (pv.empty()) {
+            // With the TT warm from earlier searches, the root itself can be answered from it
+            pv = line_from_tt(m_tt, pos, hash, depth);
+        }
+        if (!pv.empty()) {
+            best_line = pv;
+        }
+        previous_depth_time = last_depth_time;
+        last_depth_time = Clock::now() - depth_start;
+
+        std::ostringstream info;
+        info.imbue(std::locale::classic());
+        info << "info depth " << depth
+             << " lower " << lower_bound
+             << " upper " << upper_bound
+             << " leaves " << num_leaves
+             << " time " << std::chrono::duration_cast<Milliseconds>(Clock::now() - start).count()
+             << " pv";
+        bool white = white_to_move;
+        for (const Move& move : pv) {
+            info << " " << move_to_string(move, white);
+            white = !white;
+        }
+        write(info.str());
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_wake.wait(lock, [this] { return !m_waiting; });
+        m_search_done = true;
+    }
+    m_wake.notify_all();
+
+    std::string bestmove = "bestmove ";
+    if (game_over) {
+        bestmove += "(none)";
+    } else {
+        // If not even depth 1 finished, any move is better than none
+        MoveList movelist;
+        gen_moves(movelist, pos);
+        bestmove += move_to_string(best_line.empty() ? movelist[0].move : best_line[0], white_to_move);
+        if (best_line.size() >= 2) {
+            bestmove += " ponder " + move_to_string(best_line[1], !white_to_move);
+        }
+    }
+    write(bestmove);
+}
+
+// Stops the search at the hard limit. The budget can start or change under it at ponderhit, so it's read afresh on every wake.
+void Engine::watch_clock()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_search_done && !m_stop) {
+        if (!m_budget.is_limited) {
+            m_wake.wait(lock);
+        } else if (Clock::now() >= m_clock_start + m_budget.hard) {
+            m_stop = true;
+        } else {
+            m_wake.wait_until(lock, m_clock_start + m_budget.hard);
+        }
+    }
+}
+
+// Each depth takes about as many times longer than the last as the last did than the one before,
+// so a depth that wouldn't finish by the hard limit isn't started; it'd only be thrown away.
+bool Engine::has_time_for_depth(Clock::duration last_depth, Clock::duration previous_depth)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_budget.is_limited) {
+        return true;
+    }
+    Clock::duration elapsed = Clock::now() - m_clock_start;
+    if (elapsed >= m_budget.soft) {
+        return false;
+    }
+    double growth = previous_depth.count() > 0
+                  ? std::clamp(double(last_depth.count()) / previous_depth.count(), 2.0, 16.0)
+                  : 2.0;
+    return elapsed + std::chrono::duration_cast<Clock::duration>(last_depth * growth) <= m_budget.hard;
+}
+
+void Engine::write(const std::string& line)
+{
+    std::lock_guard<std::mutex> lock(m_out_mutex);
+    m_out << line << std::endl;
+}
+
+
+GoParams parse_go(std::istringstream& args)
+{
+    GoParams params;
+    auto read_number = [&args](const std::string& name) -> int {
+        int value;
+        if (!(args >> value) || value < 0) {
+            throw std::runtime_error("go " + name + " needs a number");
+        }
+        return value;
+    };
+    std::string word;
+    while (args >> word) {
+        if (word == "movetime") {
+            params.movetime = Milliseconds(read_number(word));
+        } else if (word == "wtime") {
+            params.clock[0] = Milliseconds(read_number(word));
+        } else if (word == "btime") {
+            params.clock[1] = Milliseconds(read_number(word));
+        } else if (word == "winc") {
+            params.increment[0] = Milliseconds(read_number(word));
+        } else if (word == "binc") {
+            params.increment[1] = Milliseconds(read_number(word));
+        } else if (word == "movestogo") {
+            params.moves_to_go = read_number(word);
+        } else if (word == "depth") {
+            params.max_depth = read_number(word);
+        } else if (word == "infinite") {
+            params.infinite = true;
+        } else if (word == "ponder") {
+            params.ponder = true;
+        } else {
+            throw std::runtime_error("Unknown go parameter " + word);
+        }
+    }
+    return params;
+}
+
+// Without a movetime or a clock for the side to move, there's no limit but max_depth
+TimeBudget plan_time(const GoParams& params, bool white_to_move)
+{
+    if (params.infinite) {
+        return {false, {}, {}};
+    }
+    if (params.movetime) {
+        Milliseconds limit = std::max(*params.movetime - MOVE_OVERHEAD, Milliseconds(1));
+        return {true, limit, limit};
+    }
+    int side = white_to_move ? 0 : 1;
+    if (!params.clock[side]) {
+        return {false, {}, {}};
+    }
+    // An even share of what's left plus most of the increment, allowed to run over by a few times
+    // if a depth looks like it'll finish, but never past half the clock
+    Milliseconds remaining = std::max(*params.clock[side] - MOVE_OVERHEAD, Milliseconds(1));
+    int moves_to_go = params.moves_to_go > 0 ? params.moves_to_go : DEFAULT_MOVES_TO_GO;
+    Milliseconds soft = std::min(remaining / moves_to_go + params.increment[side] * 3 / 4, remaining / 2);
+    Milliseconds hard = std::min(soft * 4, remaining / 2);
+    return {true, soft, hard};
+}
+
+// Black's moves are made on the flipped board, so their squares are flipped to match
+Move parse_move(const std::string& text, bool white_to_move)
+{
+    auto is_square = [&text](std::size_t i) -> bool {
+        return text[i] >= 'a' && text[i] <= 'h' && text[i + 1] >= '1' && text[i + 1] <= '8';
+    };
+    if (text.size() != 4 || !is_square(0) || !is_square(2)) {
+        throw std::runtime_error("Invalid move " + text);
+    }
+    unsigned int flip = white_to_move ? 0 : 56;
+    return to_move(parse_coords(text.substr(0, 2)) ^ flip, parse_coords(text.substr(2, 2)) ^ flip);
+}
+
+std::string move_to_string(const Move& move, bool white_to_move)
+{
+    unsigned int flip = white_to_move ? 0 : 56;
+    return bitnum_to_coords(move.src_bitnum ^ flip) + bitnum_to_coords(move.dest_bitnum ^ flip);
+}
+
+// Lost, by having no pawns or one of theirs on my first rank, or stalemated
+bool is_game_over(const Position& pos)
+{
+    return !pos.my_pawns || (pos.their_pawns & RANK_1) || count_moves(pos) == 0;
+}
+
+// Follows the TT's best moves from pos, for as long as they're there and legal
+Variation line_from_tt(const TranspositionTable& tt, const Position& pos, const PositionHash& hash, int max_length)
+{
+    Variation line;
+    Position line_pos = pos;
+    PositionHash line_hash = hash;
+    TTEntry entry;
+    while (static_cast<int>(line.size()) < max_length &&
+           tt.fetch(line_hash.canonical(), entry) &&
+           entry.best_move) {
+        // The TT's best move is for the canonical position, which may be this one's mirror
+        Move move = line_hash.canonical() != line_hash.hash ? mirror_move(*entry.best_move) : *entry.best_move;
+        MoveList movelist;
+        gen_moves(movelist, line_pos);
+        auto it = std::find_if(movelist.begin(), movelist.end(), [&move](const SearchMove& legal_move) {
+            return legal_move.move == move;
+        });
+        if (it == movelist.end()) {
+            break;
+        }
+        line.push_back(move);
+        line_hash = update_position_hash(line_hash, line_pos, it->new_pos).flipped();
+        line_pos = flip_board(it->new_pos);
+    }
+    return line;
+}
+
+} // anon namespace
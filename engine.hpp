@@ -0,0 +1,28 @@
+#ifndef PEASANT_ENGINE_HPP
+#define PEASANT_ENGINE_HPP
+
+#include <cstddef>
+#include <iosfwd>
+#include "tablebase.hpp"
+
+struct EngineOptions
+{
+    std::size_t tt_buckets = 0x10'0000;
+};
+
+// Plays through a line protocol on `in` and `out`, modelled on UCI. Moves are written like c3c4, from white's POV.
+//   position startpos|fen <board> <en passant> [moves <move>...]
+//   go [movetime <ms>] [wtime <ms>] [btime <ms>] [winc <ms>] [binc <ms>] [movestogo <n>] [depth <n>] [infinite] [ponder]
+//   stop          give the best move found so far
+//   ponderhit     the move being pondered on was played; carry on under the go's time limits
+//   isready       answered with readyok
+//   quit
+// The search runs on a thread of its own, so commands are taken while it thinks. It writes
+// "info depth <n> lower <score> upper <score> leaves <n> time <ms> pv <moves>" after each depth it finishes,
+// and "bestmove <move> [ponder <move>]" (or "bestmove (none)" once the game is over) when it's done.
+// Infinite and ponder searches hold on to the best move until stop or ponderhit.
+// The TT is kept from one search to the next, so pondering on the expected reply leaves it warm
+// for the search that follows the reply.
+void run_engine(std::istream& in, std::ostream& out, const EngineOptions& options, const Tablebase* tablebase);
+
+#endif
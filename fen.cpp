@@ -0,0 +1,112 @@
+#include <regex>
+#include <stdexcept>
+#include "coords.hpp"
+#include "fen.hpp"
+
+Position parse_fen(const std::string& fen)
+{
+    Bitboard white_pawns = 0;
+    Bitboard black_pawns = 0;
+    std::regex re("([Xo1-8]+)/"
+                  "([Xo1-8]+)/"
+                  "([Xo1-8]+)/"
+                  "([Xo1-8]+)/"
+                  "([Xo1-8]+)/"
+                  "([Xo1-8]+)/"
+                  "([Xo1-8]+)/"
+                  "([Xo1-8]+)"
+                  " ([a-h][36]|-)");
+    std::smatch match;
+    if (!std::regex_match(fen, match, re)) {
+        throw std::runtime_error("Position is in invalid format");
+    }
+    for (int i = 1; i <= 8; ++i) {
+        int num_columns = 0;
+        for (char ch : match[i].str()) {
+            int shift_count = 1;
+            int black_bit = 0;
+            int white_bit = 0;
+            if (ch == 'X') {
+                // It's a black pawn
+                black_bit = 1;              // gets shifted into black_pawns' LSB
+            } else if (ch == 'o') {
+                // It's a white pawn
+                white_bit = 1;
+            } else {
+                // It's a digit
+                shift_count = ch - '0';
+            }
+            black_pawns = (black_pawns << shift_count) | black_bit;
+            white_pawns = (white_pawns << shift_count) | white_bit;
+            num_columns += shift_count;
+        }
+        if (num_columns != 8) {
+            throw std::runtime_error("Position is not 8x8");
+        }
+    }
+
+    // Position keeps the en passant square on the back rank behind the side not to move,
+    // which flipping makes white's first rank on black's turn, so neither side may have a pawn there
+    if (black_pawns & RANK_8) {
+        throw std::runtime_error("Black pawn on the eighth rank");
+    }
+    if (white_pawns & RANK_1) {
+        throw std::runtime_error("White pawn on the first rank");
+    }
+
+    std::string en_passant_str = match[9].str();
+    std::optional<unsigned int> en_passant;
+    if (en_passant_str != "-") {
+        en_passant = parse_coords(en_passant_str);
+        if (*en_passant / 8 != 5) {
+            throw std::runtime_error("En passant square is not on the sixth rank");
+        }
+    }
+
+    return make_position(white_pawns, black_pawns, en_passant);
+}
+
+
+// The inverse of parse_fen
+std::string position_to_fen(const Position& pos)
+{
+    std::string fen;
+    for (int row = 7; row >= 0; --row) {
+        int num_empty = 0;
+        for (int col = 7; col >= 0; --col) {
+            Bitboard square = 1ULL << (row*8 + col);
+            char ch = (pos.my_pawns & square) ? 'o' : (pos.their_pawns_only() & square) ? 'X' : 0;
+            if (!ch) {
+                ++num_empty;
+                continue;
+            }
+            if (num_empty) {
+                fen += static_cast<char>('0' + num_empty);
+                num_empty = 0;
+            }
+            fen += ch;
+        }
+        if (num_empty) {
+            fen += static_cast<char>('0' + num_empty);
+        }
+        fen += row ? "/" : " ";
+    }
+    fen += pos.has_en_passant() ? bitnum_to_coords(pos.en_passant_bitnum()) : "-";
+    return fen;
+}
+
+
+// @TODO@ -- result has extra space at the end
+std::string variation_to_string(const Variation& variation)
+{
+    std::string out;
+    bool white = true;
+    for (const Move& move : variation) {
+        unsigned int flip = white ? 0 : 56;         // black's moves need to be flipped
+        out += bitnum_to_coords(move.src_bitnum ^ flip);
+        out += bitnum_to_coords(move.dest_bitnum ^ flip);
+        out += " ";
+        white = !white;
+    }
+    return out;
+}
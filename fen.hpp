@@ -0,0 +1,17 @@
+#ifndef PEASANT_FEN_HPP
+#define PEASANT_FEN_HPP
+
+#include <string>
+#include "position.hpp"
+#include "search.hpp"
+
+// Positions are written like FEN, with X for black pawns and o for white pawns, then the en passant square or -
+const std::string START_POS = "8/XXXXXXXX/XXXXXXXX/8/8/oooooooo/oooooooo/8 -";
+
+Position parse_fen(const std::string& fen);
+std::string position_to_fen(const Position& pos);
+
+// The moves in coordinate notation, for a line that starts with white to move
+std::string variation_to_string(const Variation& variation);
+
+#endif
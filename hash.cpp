@@ -0,0 +1,190 @@
+#include <random>
+#include "hash.hpp"
+#include "movegen.hpp"
+
+namespace
+{
+std::uint64_t g_zobrist_codes[8][0x10000];
+std::uint64_t g_square_codes[2][64];            // [0] is my pawns, [1] is their pawns
+
+std::uint64_t get_chunk(Bitboard board, int chunk_num);
+std::uint64_t swap_chunk_bytes(std::uint64_t chunk);
+std::uint64_t mix64(std::uint64_t x);
+}
+
+
+// Call this at program start
+void init_zobrist()
+{
+    std::mt19937_64 rng;
+    for (int i = 0; i < 8; ++i) {
+        for (int j = 0; j < 0x10000; ++j) {
+            g_zobrist_codes[i][j] = rng();
+        }
+    }
+    for (int side = 0; side < 2; ++side) {
+        for (int i = 0; i < 64; ++i) {
+            g_square_codes[side][i] = rng();
+        }
+    }
+}
+
+
+std::uint64_t calc_hash(const Position& pos)
+{
+    return SelectedHash::calc(pos);
+}
+
+PositionHash calc_position_hash(const Position& pos)
+{
+    return calc_position_hash<SelectedHash>(pos);
+}
+
+// Same as calc_position_hash(pos).canonical(), but only hashes two boards
+std::uint64_t calc_canonical_hash(const Position& pos)
+{
+    return std::min(calc_hash(pos), calc_hash(mirror_board(pos)));
+}
+
+PositionHash update_position_hash(const PositionHash& hash, const Position& old_pos, const Position& new_pos)
+{
+    return SelectedHash::update(hash, old_pos, new_pos);
+}
+
+
+std::uint64_t ChunkedHash::calc(const Position& pos)
+{
+    Bitboard my_pawns = pos.my_pawns;
+    Bitboard their_pawns = pos.their_pawns;
+    // The en passant marker is just another bit of their_pawns, so it needs no key of its own
+    std::uint64_t hash = g_zobrist_codes[0][0xffff & my_pawns];
+    hash ^= g_zobrist_codes[1][0xffff & (my_pawns >> 16)];
+    hash ^= g_zobrist_codes[2][0xffff & (my_pawns >> 32)];
+    hash ^= g_zobrist_codes[3][0xffff & (my_pawns >> 48)];
+    hash ^= g_zobrist_codes[4][0xffff & their_pawns];
+    hash ^= g_zobrist_codes[5][0xffff & (their_pawns >> 16)];
+    hash ^= g_zobrist_codes[6][0xffff & (their_pawns >> 32)];
+    hash ^= g_zobrist_codes[7][0xffff & (their_pawns >> 48)];
+    return hash;
+}
+
+template<typename Backend>
+PositionHash calc_position_hash(const Position& pos)
+{
+    Position flipped_pos = flip_board(pos);
+    return {Backend::calc(pos),
+            Backend::calc(flipped_pos),
+            Backend::calc(mirror_board(pos)),
+            Backend::calc(mirror_board(flipped_pos))};
+}
+
+template PositionHash calc_position_hash<ChunkedHash>(const Position& pos);
+template PositionHash calc_position_hash<PerSquareHash>(const Position& pos);
+template PositionHash calc_position_hash<MixHash>(const Position& pos);
+
+
+// Only the 16-bit chunks the move touched are rehashed, and usually there are only two or three.
+// Chunk n of a vflipped bitboard is chunk 3-n of the original with its two bytes swapped,
+// and chunk n of a mirrored bitboard is chunk n mirrored, so none of the other boards need to be made.
+PositionHash ChunkedHash::update(const PositionHash& hash, const Position& old_pos, const Position& new_pos)
+{
+    PositionHash result = hash;
+    for (int side = 0; side < 2; ++side) {
+        Bitboard old_pawns = side == 0 ? old_pos.my_pawns : old_pos.their_pawns;
+        Bitboard new_pawns = side == 0 ? new_pos.my_pawns : new_pos.their_pawns;
+        for (int i = 0; i < 4; ++i) {
+            if (get_chunk(old_pawns ^ new_pawns, i) == 0) {
+                continue;
+            }
+            std::uint64_t old_chunk = get_chunk(old_pawns, i);
+            std::uint64_t new_chunk = get_chunk(new_pawns, i);
+            std::uint64_t old_mirrored_chunk = mirror_bitboard(old_chunk);
+            std::uint64_t new_mirrored_chunk = mirror_bitboard(new_chunk);
+            // My pawns are their pawns once the board is flipped, and vice versa
+            int table = 4*side + i;
+            int flipped_table = 4*(1 - side) + 3 - i;
+            result.hash ^= g_zobrist_codes[table][old_chunk] ^ g_zobrist_codes[table][new_chunk];
+            result.flipped_hash ^= g_zobrist_codes[flipped_table][swap_chunk_bytes(old_chunk)]
+                                 ^ g_zobrist_codes[flipped_table][swap_chunk_bytes(new_chunk)];
+            result.mirrored_hash ^= g_zobrist_codes[table][old_mirrored_chunk]
+                                  ^ g_zobrist_codes[table][new_mirrored_chunk];
+            result.flipped_mirrored_hash ^= g_zobrist_codes[flipped_table][swap_chunk_bytes(old_mirrored_chunk)]
+                                          ^ g_zobrist_codes[flipped_table][swap_chunk_bytes(new_mirrored_chunk)];
+        }
+    }
+    return result;
+}
+
+
+std::uint64_t PerSquareHash::calc(const Position& pos)
+{
+    std::uint64_t hash = 0;
+    for (Bitboard board = pos.my_pawns; board; board &= board - 1) {
+        hash ^= g_square_codes[0][lowest_bitnum(board)];
+    }
+    for (Bitboard board = pos.their_pawns; board; board &= board - 1) {
+        hash ^= g_square_codes[1][lowest_bitnum(board)];
+    }
+    return hash;
+}
+
+// A pawn of mine on a square is, after flip_board, a pawn of theirs on the square ^ 56, and vice versa.
+// Mirroring takes a square to the square ^ 7.
+PositionHash PerSquareHash::update(const PositionHash& hash, const Position& old_pos, const Position& new_pos)
+{
+    PositionHash result = hash;
+    for (Bitboard changes = old_pos.my_pawns ^ new_pos.my_pawns; changes; changes &= changes - 1) {
+        unsigned int bitnum = lowest_bitnum(changes);
+        result.hash ^= g_square_codes[0][bitnum];
+        result.flipped_hash ^= g_square_codes[1][bitnum ^ 56];
+        result.mirrored_hash ^= g_square_codes[0][bitnum ^ 7];
+        result.flipped_mirrored_hash ^= g_square_codes[1][bitnum ^ 63];
+    }
+    for (Bitboard changes = old_pos.their_pawns ^ new_pos.their_pawns; changes; changes &= changes - 1) {
+        unsigned int bitnum = lowest_bitnum(changes);
+        result.hash ^= g_square_codes[1][bitnum];
+        result.flipped_hash ^= g_square_codes[0][bitnum ^ 56];
+        result.mirrored_hash ^= g_square_codes[1][bitnum ^ 7];
+        result.flipped_mirrored_hash ^= g_square_codes[0][bitnum ^ 63];
+    }
+    return result;
+}
+
+
+std::uint64_t MixHash::calc(const Position& pos)
+{
+    std::uint64_t hash = mix64(pos.my_pawns ^ 0x9e37'79b9'7f4a'7c15ULL);
+    return mix64(hash ^ pos.their_pawns);
+}
+
+PositionHash MixHash::update(const PositionHash&, const Position&, const Position& new_pos)
+{
+    return calc_position_hash<MixHash>(new_pos);
+}
+
+
+namespace
+{
+
+std::uint64_t get_chunk(Bitboard board, int chunk_num)
+{
+    return 0xffff & (board >> (16*chunk_num));
+}
+
+std::uint64_t swap_chunk_bytes(std::uint64_t chunk)
+{
+    return ((chunk & 0xff) << 8) | (chunk >> 8);
+}
+
+// The finalizer from MurmurHash3
+std::uint64_t mix64(std::uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51'afd7'ed55'8ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ce'b9fe'1a85'ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+} // anon namespace
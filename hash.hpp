@@ -0,0 +1,84 @@
+#ifndef PEASANT_HASH_HPP
+#define PEASANT_HASH_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include "position.hpp"
+
+// The hashes of a position, of the same position after flip_board, and of the mirrors of both.
+// Carrying all four means a child's hashes can be updated from its parent's:
+// make the move, update the hashes, and then flipping the board just swaps them.
+struct PositionHash
+{
+    std::uint64_t hash;
+    std::uint64_t flipped_hash;
+    std::uint64_t mirrored_hash;
+    std::uint64_t flipped_mirrored_hash;
+
+    bool operator==(const PositionHash& rhs) const {
+        return hash == rhs.hash &&
+               flipped_hash == rhs.flipped_hash &&
+               mirrored_hash == rhs.mirrored_hash &&
+               flipped_mirrored_hash == rhs.flipped_mirrored_hash;
+    }
+
+    PositionHash flipped() const { return {flipped_hash, hash, flipped_mirrored_hash, mirrored_hash}; }
+
+    // The same for a position and its mirror, so they can share TT entries
+    std::uint64_t canonical() const { return std::min(hash, mirrored_hash); }
+};
+
+
+// Hashing backends. Each one can hash a position from scratch and update a PositionHash after a move.
+// For update, new_pos is old_pos with a move made, before the board is flipped.
+
+// The original scheme: each 16-bit chunk of each bitboard indexes its own table of 64K keys.
+// Only eight lookups per hash, but the tables take 4 MiB, far more than fits in cache.
+struct ChunkedHash
+{
+    static const char* name() { return "chunked"; }
+    static std::uint64_t calc(const Position& pos);
+    static PositionHash update(const PositionHash& hash, const Position& old_pos, const Position& new_pos);
+};
+
+// Classic Zobrist hashing with a key for each square for each side: 1.5 KiB of keys, which stay in L1.
+// Hashing from scratch costs a lookup per pawn, but a move only changes two or three keys.
+struct PerSquareHash
+{
+    static const char* name() { return "per-square"; }
+    static std::uint64_t calc(const Position& pos);
+    static PositionHash update(const PositionHash& hash, const Position& old_pos, const Position& new_pos);
+};
+
+// No tables at all: the bitboards are run through a multiply-xorshift mixer.
+// There's nothing to update incrementally, so update just rehashes both boards.
+struct MixHash
+{
+    static const char* name() { return "mix"; }
+    static std::uint64_t calc(const Position& pos);
+    static PositionHash update(const PositionHash& hash, const Position& old_pos, const Position& new_pos);
+};
+
+// The backend behind calc_hash is chosen at build time by defining PEASANT_HASH_CHUNKED or PEASANT_HASH_MIX.
+// Per-square keys are the default: the mixer hashes from scratch faster, but in the search,
+// where nearly every hash is an update, per-square keys came out ahead.
+#if defined(PEASANT_HASH_CHUNKED)
+typedef ChunkedHash SelectedHash;
+#elif defined(PEASANT_HASH_MIX)
+typedef MixHash SelectedHash;
+#else
+typedef PerSquareHash SelectedHash;
+#endif
+
+
+void init_zobrist();
+std::uint64_t calc_hash(const Position& pos);
+PositionHash calc_position_hash(const Position& pos);
+std::uint64_t calc_canonical_hash(const Position& pos);
+PositionHash update_position_hash(const PositionHash& hash, const Position& old_pos, const Position& new_pos);
+
+// Computes all four hashes from scratch with the given backend
+template<typename Backend>
+PositionHash calc_position_hash(const Position& pos);
+
+#endif
@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include "hash.hpp"
+#include "hash_bench.hpp"
+#include "movegen.hpp"
+
+namespace
+{
+// Results get XORed in here so the compiler can't throw the hashing away
+volatile std::uint64_t g_sink;
+
+void collect_positions(int depth, const Position& pos, std::vector<Position>& positions);
+template<typename Backend> HashBenchResult bench_backend(int depth, const Position& pos, const std::vector<Position>& positions);
+template<typename Backend> std::uint64_t walk_tree(int depth, const Position& pos, const PositionHash& hash, std::uint64_t& checksum);
+std::uint64_t count_duplicates(std::vector<std::uint64_t>& values);
+double seconds_since(std::chrono::steady_clock::time_point start);
+}
+
+
+// Compares every hashing backend, not just the one calc_hash uses, on the distinct positions
+// found depth plies from pos and on a walk of the whole tree down to that depth
+std::vector<HashBenchResult> hash_benchmark(int depth, const Position& pos)
+{
+    std::vector<Position> positions;
+    collect_positions(depth, pos, positions);
+    auto by_boards = [](const Position& a, const Position& b) -> bool {
+        if (a.my_pawns != b.my_pawns) {
+            return a.my_pawns < b.my_pawns;
+        }
+        return a.their_pawns < b.their_pawns;
+    };
+    std::sort(positions.begin(), positions.end(), by_boards);
+    positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+
+    return {bench_backend<ChunkedHash>(depth, pos, positions),
+            bench_backend<PerSquareHash>(depth, pos, positions),
+            bench_backend<MixHash>(depth, pos, positions)};
+}
+
+
+namespace
+{
+
+void collect_positions(int depth, const Position& pos, std::vector<Position>& positions)
+{
+    if (depth == 0) {
+        positions.push_back(pos);
+        return;
+    }
+
+    MoveList movelist;
+    gen_moves(movelist, pos);
+    for (const SearchMove& move : movelist) {
+        collect_positions(depth - 1, flip_board(move.new_pos), positions);
+    }
+}
+
+
+template<typename Backend>
+HashBenchResult bench_backend(int depth, const Position& pos, const std::vector<Position>& positions)
+{
+    HashBenchResult result;
+    result.backend_name = Backend::name();
+    result.num_positions = positions.size();
+
+    std::vector<std::uint64_t> hashes;
+    hashes.reserve(positions.size());
+    auto start = std::chrono::steady_clock::now();
+    for (const Position& position : positions) {
+        hashes.push_back(Backend::calc(position));
+    }
+    result.hashes_per_sec = positions.size() / seconds_since(start);
+
+    std::vector<std::uint64_t> low_hashes;
+    low_hashes.reserve(hashes.size());
+    for (std::uint64_t hash : hashes) {
+        low_hashes.push_back(hash & 0xffff'ffff);
+    }
+    result.num_collisions = count_duplicates(hashes);
+    result.num_low_collisions = count_duplicates(low_hashes);
+    double n = static_cast<double>(positions.size());
+    result.expected_low_collisions = n*(n - 1)/2/4'294'967'296.0;
+
+    std::uint64_t checksum = 0;
+    start = std::chrono::steady_clock::now();
+    std::uint64_t num_nodes = walk_tree<Backend>(depth, pos, calc_position_hash<Backend>(pos), checksum);
+    result.nodes_per_sec = num_nodes / seconds_since(start);
+    g_sink = g_sink ^ checksum;
+
+    return result;
+}
+
+// Returns the number of nodes visited
+template<typename Backend>
+std::uint64_t walk_tree(int depth, const Position& pos, const PositionHash& hash, std::uint64_t& checksum)
+{
+    assert(hash == calc_position_hash<Backend>(pos));
+    checksum ^= hash.hash;
+    if (depth == 0) {
+        return 1;
+    }
+
+    MoveList movelist;
+    gen_moves(movelist, pos);
+    std::uint64_t num_nodes = 1;
+    for (const SearchMove& move : movelist) {
+        num_nodes += walk_tree<Backend>(depth - 1,
+                                        flip_board(move.new_pos),
+                                        Backend::update(hash, pos, move.new_pos).flipped(),
+                                        checksum);
+    }
+    return num_nodes;
+}
+
+
+// Sorts values; returns how many are equal to the one before them
+std::uint64_t count_duplicates(std::vector<std::uint64_t>& values)
+{
+    std::sort(values.begin(), values.end());
+    std::uint64_t num_duplicates = 0;
+    for (std::size_t i = 1; i < values.size(); ++i) {
+        if (values[i] == values[i - 1]) {
+            ++num_duplicates;
+        }
+    }
+    return num_duplicates;
+}
+
+
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // anon namespace
@@ -0,0 +1,22 @@
+#ifndef PEASANT_HASH_BENCH_HPP
+#define PEASANT_HASH_BENCH_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "position.hpp"
+
+struct HashBenchResult
+{
+    std::string backend_name;
+    std::uint64_t num_positions;                // distinct positions hashed
+    std::uint64_t num_collisions;               // distinct positions sharing a full 64-bit hash
+    std::uint64_t num_low_collisions;           // same, looking only at the low 32 bits
+    double expected_low_collisions;             // what an ideal random hash would give for the low 32 bits
+    double hashes_per_sec;                      // hashing from scratch
+    double nodes_per_sec;                       // walking the tree, updating hashes as moves are made
+};
+
+std::vector<HashBenchResult> hash_benchmark(int depth, const Position& pos);
+
+#endif
@@ -0,0 +1,92 @@
+#include <atomic>
+#include "lazy_smp.hpp"
+#include "threadpool.hpp"
+
+namespace
+{
+bool is_proven(const SearchResult& result);
+}
+
+
+// Searches pos on several threads that share one transposition table (Lazy SMP).
+// Thread 0 searches to the requested depth. The helpers keep searching, half of them a ply deeper,
+// so that they fill the table with results thread 0 can use.
+// The search ends as soon as thread 0 finishes or a helper proves the result of the game.
+// Either way, the result and pv come from whichever thread finished first.
+// num_leaves and cutoff_stats are totals over every thread, including the searches that got cut off.
+// So are stats, which are added to if they aren't null.
+SearchResult lazy_smp_search(int depth,
+                             const Position& pos,
+                             int alpha,
+                             int beta,
+                             TranspositionTable& tt,
+                             const Tablebase* tablebase,
+                             unsigned int num_threads,
+                             Variation& pv,
+                             CutoffStats& cutoff_stats,
+                             SearchStats* stats)
+{
+    WorkStealingPool pool(num_threads);
+    std::atomic<bool> stop(false);
+    std::atomic<int> winner(-1);
+    std::atomic<std::uint64_t> total_leaves(0);
+    std::vector<SearchResult> results(pool.num_threads());
+    std::vector<Variation> variations(pool.num_threads());
+    std::vector<CutoffStats> thread_cutoff_stats(pool.num_threads());
+    std::vector<SearchStats> thread_stats(stats ? pool.num_threads() : 0);
+    PositionHash hash = calc_position_hash(pos);
+
+    for (unsigned int i = 0; i < pool.num_threads(); ++i) {
+        pool.add_task([&, i](unsigned int) {
+            SearchContext context = {tt, &stop, tablebase};
+            if (stats) {
+                context.stats = &thread_stats[i];
+            }
+            // Only thread 0 searches the requested depth, so only it can finish without a proof
+            for (int helper_depth = depth + i%2; !context.is_stopped(); helper_depth += 2) {
+                SearchResult result = search_node(helper_depth, pos, hash, alpha, beta, context);
+                total_leaves += result.num_leaves;
+                if (i == 0 || is_proven(result)) {
+                    // Nobody sets the stop flag without winning first,
+                    // so if we win, our search ran to completion
+                    int no_winner = -1;
+                    if (winner.compare_exchange_strong(no_winner, i)) {
+                        results[i] = result;
+                        variations[i] = context.pv_table.line(0);
+                        stop = true;
+                    }
+                    break;
+                }
+                if (helper_depth + 2 > static_cast<int>(MAX_DEPTH)) {
+                    break;
+                }
+            }
+            thread_cutoff_stats[i] = context.cutoff_stats;
+        });
+    }
+
+    pool.run();
+
+    SearchResult result = results[winner];
+    result.num_leaves = total_leaves;
+    pv = variations[winner];
+    cutoff_stats = {};
+    for (const CutoffStats& thread_cutoffs : thread_cutoff_stats) {
+        cutoff_stats += thread_cutoffs;
+    }
+    for (const SearchStats& thread_stat : thread_stats) {
+        *stats += thread_stat;
+    }
+    return result;
+}
+
+
+namespace
+{
+
+bool is_proven(const SearchResult& result)
+{
+    return result.lower_bound == result.upper_bound;
+}
+
+} // anon namespace
@@ -0,0 +1,19 @@
+#ifndef PEASANT_LAZY_SMP_HPP
+#define PEASANT_LAZY_SMP_HPP
+
+#include "position.hpp"
+#include "search.hpp"
+#include "tt.hpp"
+
+SearchResult lazy_smp_search(int depth,
+                             const Position& pos,
+                             int alpha,
+                             int beta,
+                             TranspositionTable& tt,
+                             const Tablebase* tablebase,
+                             unsigned int num_threads,
+                             Variation& pv,
+                             CutoffStats& cutoff_stats,
+                             SearchStats* stats);
+
+#endif
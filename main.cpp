@@ -1,28 +1,92 @@
+#include <algorithm>
 #include <chrono>
-#include <regex>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
 #include <string>
 #include <boost/program_options.hpp>
+#include "batch.hpp"
+#include "checkpoint.hpp"
 #include "coords.hpp"
+#include "distributed.hpp"
+#include "engine.hpp"
+#include "fen.hpp"
+#include "hash_bench.hpp"
+#include "lazy_smp.hpp"
+#include "null_window.hpp"
+#include "parallel_perft.hpp"
+#include "perft_batch.hpp"
+#include "proof.hpp"
 #include "search.hpp"
+#include "tablebase.hpp"
 #include "tt.hpp"
+#include "unique_perft.hpp"
 
 namespace po = boost::program_options;
 
-const std::size_t TT_BUCKETS = 0x10'0000;
-const std::size_t TT_SLOTS_PER_BUCKET = 4;
+const std::size_t TT_BUCKETS = 0x10'0000;             // 64 MiB
+const std::size_t PROOF_TABLE_BUCKETS = 0x10'0000;    // 64 MiB
+const std::size_t PNS_MAX_NODES = 0x40'0000;          // about 400 MiB
 
 namespace
 {
-void solve(const Position& pos, int start_depth, int max_depth);
-void perft(const Position& pos, int start_depth, int max_depth, bool split);
-Position parse_fen(const std::string& fen);
-std::string variation_to_string(const Variation& variation);
+// Where --stats and --stats-json send the search statistics
+struct StatsOutput
+{
+    bool print;
+    std::ostream* json;                 // may be null
+
+    bool is_wanted() const { return print || json; }
+};
+
+// Where --checkpoint saves the solve, and whether --resume picks it up again
+struct CheckpointOptions
+{
+    std::string filename;               // empty for no checkpoints
+    std::chrono::seconds interval;
+    bool resume;
+};
+
+void solve(const Position& pos,
+           int start_depth,
+           int max_depth,
+           const Tablebase* tablebase,
+           unsigned int num_threads,
+           bool show_speedup,
+           const StatsOutput& stats_output,
+           const CheckpointOptions& checkpoint_options);
+std::vector<double> run_solver(const Position& pos,
+                               int start_depth,
+                               int max_depth,
+                               const Tablebase* tablebase,
+                               unsigned int num_threads,
+                               const std::vector<double>& baseline_times,
+                               const StatsOutput& stats_output,
+                               const CheckpointOptions& checkpoint_options);
+void print_stats(const SearchStats& stats, const CutoffStats& cutoff_stats, double ebf, double tt_occupancy);
+void write_stats_json(std::ostream& out,
+                      int depth,
+                      const SearchStats& stats,
+                      const CutoffStats& cutoff_stats,
+                      double ebf,
+                      double tt_occupancy);
+void prove(const Position& pos, const std::string& solver, const Tablebase* tablebase);
+void print_verdict(int score);
+void generate_tablebase(Tablebase& tablebase, unsigned int num_threads);
+void perft(const Position& pos,
+           int start_depth,
+           int max_depth,
+           bool split,
+           PerftTable& table,
+           unsigned int num_threads,
+           PerftKernel kernel);
+void compare_perft(const Position& pos, int start_depth, int max_depth);
+void unique_perft(const Position& pos, int max_depth, const UniquePerftOptions& options);
+void hash_bench(const Position& pos, int start_depth, int max_depth);
 std::uint64_t now_in_microseconds();
 }
 
-const std::string START_POS = "8/XXXXXXXX/XXXXXXXX/8/8/oooooooo/oooooooo/8 -";
-
 int main(int argc, char *argv[])
 {
     init_zobrist();
@@ -37,7 +101,34 @@ int main(int argc, char *argv[])
             ("max-depth", po::value<int>(), "Maximum depth")
             ("perft", "Run in perft mode")
             ("split-perft", "Run in split perft mode")
+            ("compare-perft", "Run perft, checking the move generator against the reference one")
+            ("unique-perft", "Count the distinct positions at each ply, up to --max-depth")
+            ("unique-memory", po::value<std::size_t>(), "Memory in MiB for --unique-perft before it spills to disk (default 1024)")
+            ("spill-dir", po::value<std::string>(), "Where --unique-perft spills to (default: the system's temporary directory)")
+            ("hash-bench", "Compare the hashing backends on the positions at each depth")
+            ("perft-hash", po::value<std::size_t>(), "Size of perft transposition table in MiB (default 0, i.e. none)")
+            ("perft-kernel", po::value<std::string>(), "How perft counts: batched (the last ply counted with SIMD, the default) or depth-first")
+            ("threads", po::value<unsigned int>(), "Number of threads to use (default 1)")
+            ("solver", po::value<std::string>(), "How to solve: ab (iterative-deepening alpha-beta, the default), pns or dfpn")
+            ("speedup", "When solving with several threads, solve with one thread first and report the speedup")
+            ("stats", "Print search statistics after each depth")
+            ("stats-json", po::value<std::string>(), "Also append the search statistics to this file, one JSON line per depth")
+            ("checkpoint", po::value<std::string>(), "Save the solve's progress and transposition table to this file every so often")
+            ("checkpoint-interval", po::value<int>(), "Seconds between checkpoints (default 600)")
+            ("resume", "Carry on from the file given by --checkpoint")
+            ("tb-pawns", po::value<int>(), "Use tablebases for positions with up to this many pawns per side (default 0, i.e. none)")
+            ("tb-dir", po::value<std::string>(), "Directory holding the tablebase files (default: current directory)")
+            ("gen-tb", "Generate the tablebases given by --tb-pawns, resuming any unfinished ones")
             ("pos,p", po::value<std::string>(), "Choose position to analyze")
+            ("batch", po::value<std::string>(), "Solve (or with --perft, perft) every position in this file, one per line (- for stdin), writing JSON lines as they finish")
+            ("shared-tt", "In batch mode, have every thread share one transposition table")
+            ("split", po::value<std::string>(), "Expand the position --split-plies deep and write the frontier into work units in this directory")
+            ("split-plies", po::value<int>(), "How deep --split expands the tree (default 4)")
+            ("unit-size", po::value<std::size_t>(), "Positions per work unit (default 256)")
+            ("work", po::value<std::string>(), "Solve the work units in this directory until none are left")
+            ("lease", po::value<int>(), "Seconds before a work unit whose worker stopped responding is taken over (default 300)")
+            ("merge", po::value<std::string>(), "Back up the work units' results in this directory to the root")
+            ("engine", "Play through a line protocol on stdin and stdout (position, go, stop, ponderhit, isready, quit)")
         ;
         po::variables_map vm;
         po::store(po::parse_command_line(argc, argv, desc), vm);
@@ -51,12 +142,114 @@ int main(int argc, char *argv[])
         Position pos = parse_fen(pos_fen);
         int depth = (vm.count("depth")) ? vm["depth"].as<int>() : 1;
         int max_depth = (vm.count("max-depth")) ? vm["max-depth"].as<int>() : INT_MAX;
-        if (vm.count("perft")) {
-            perft(pos, depth, max_depth, false);
-        } else if (vm.count("split-perft")) {
-            perft(pos, depth, max_depth, true);
+        unsigned int num_threads = (vm.count("threads")) ? vm["threads"].as<unsigned int>() : 1;
+        std::size_t perft_hash_mib = (vm.count("perft-hash")) ? vm["perft-hash"].as<std::size_t>() : 0;
+        PerftTable perft_table(perft_hash_mib * 1024 * 1024 / sizeof(PerftEntry));
+        int tb_pawns = (vm.count("tb-pawns")) ? vm["tb-pawns"].as<int>() : 0;
+        std::string tb_dir = (vm.count("tb-dir")) ? vm["tb-dir"].as<std::string>() : ".";
+        std::unique_ptr<Tablebase> tablebase;
+        if (tb_pawns > 0) {
+            tablebase = std::make_unique<Tablebase>(tb_dir, tb_pawns, vm.count("gen-tb") > 0);
+        }
+        if (vm.count("gen-tb")) {
+            if (!tablebase) {
+                throw std::runtime_error("--gen-tb needs --tb-pawns");
+            }
+            generate_tablebase(*tablebase, num_threads);
+        } else if (vm.count("split")) {
+            int num_plies = (vm.count("split-plies")) ? vm["split-plies"].as<int>() : 4;
+            std::size_t unit_size = (vm.count("unit-size")) ? vm["unit-size"].as<std::size_t>() : 256;
+            SplitSummary summary = split_work_units(pos, num_plies, unit_size, vm["split"].as<std::string>());
+            std::cout << summary.num_positions << " positions in " << summary.num_units << " units" << std::endl;
+        } else if (vm.count("work")) {
+            WorkerOptions options;
+            options.start_depth = depth;
+            options.max_depth = max_depth;
+            options.num_threads = num_threads;
+            options.lease_seconds = (vm.count("lease")) ? vm["lease"].as<int>() : 300;
+            options.tt_buckets = TT_BUCKETS;
+            run_worker(vm["work"].as<std::string>(), options, tablebase.get(), std::cout);
+        } else if (vm.count("merge")) {
+            MergeResult result = merge_work_results(vm["merge"].as<std::string>());
+            std::cout << "score (" << result.lower_bound << ", " << result.upper_bound << ")";
+            if (result.num_missing) {
+                std::cout << "; " << result.num_missing << " positions still to solve";
+            }
+            std::cout << std::endl;
+            if (result.lower_bound == result.upper_bound) {
+                print_verdict(result.lower_bound);
+            }
+        } else if (vm.count("engine")) {
+            EngineOptions options;
+            options.tt_buckets = TT_BUCKETS;
+            run_engine(std::cin, std::cout, options, tablebase.get());
+        } else if (vm.count("batch")) {
+            BatchOptions options;
+            options.perft = vm.count("perft") > 0;
+            options.start_depth = depth;
+            options.max_depth = max_depth;
+            options.num_threads = num_threads;
+            options.shared_tt = vm.count("shared-tt") > 0;
+            options.tt_buckets = TT_BUCKETS;
+            std::string batch_file = vm["batch"].as<std::string>();
+            if (batch_file == "-") {
+                run_batch(std::cin, std::cout, options, tablebase.get(), perft_table);
+            } else {
+                std::ifstream in(batch_file);
+                if (!in) {
+                    throw std::runtime_error("Can't open " + batch_file);
+                }
+                run_batch(in, std::cout, options, tablebase.get(), perft_table);
+            }
+        } else if (vm.count("perft") || vm.count("split-perft")) {
+            std::string kernel_name = (vm.count("perft-kernel")) ? vm["perft-kernel"].as<std::string>() : "batched";
+            PerftKernel kernel;
+            if (kernel_name == "batched") {
+                kernel = batched_perft_node;
+            } else if (kernel_name == "depth-first") {
+                kernel = perft_node;
+            } else {
+                throw std::runtime_error("Unknown perft kernel");
+            }
+            perft(pos, depth, max_depth, vm.count("split-perft") > 0, perft_table, num_threads, kernel);
+        } else if (vm.count("unique-perft")) {
+            UniquePerftOptions options;
+            if (vm.count("unique-memory")) {
+                options.memory_bytes = vm["unique-memory"].as<std::size_t>() * 1024 * 1024;
+            }
+            if (vm.count("spill-dir")) {
+                options.spill_directory = vm["spill-dir"].as<std::string>();
+            }
+            options.num_threads = num_threads;
+            unique_perft(pos, max_depth, options);
+        } else if (vm.count("compare-perft")) {
+            compare_perft(pos, depth, max_depth);
+        } else if (vm.count("hash-bench")) {
+            hash_bench(pos, depth, max_depth);
         } else {
-            solve(pos, depth, max_depth);
+            std::string solver = (vm.count("solver")) ? vm["solver"].as<std::string>() : "ab";
+            if (solver == "pns" || solver == "dfpn") {
+                prove(pos, solver, tablebase.get());
+            } else if (solver == "ab") {
+                std::ofstream stats_json;
+                if (vm.count("stats-json")) {
+                    stats_json.open(vm["stats-json"].as<std::string>(), std::ios::app);
+                    if (!stats_json) {
+                        throw std::runtime_error("Can't open " + vm["stats-json"].as<std::string>());
+                    }
+                }
+                StatsOutput stats_output = {vm.count("stats") > 0, stats_json.is_open() ? &stats_json : nullptr};
+                CheckpointOptions checkpoint_options = {
+                    (vm.count("checkpoint")) ? vm["checkpoint"].as<std::string>() : "",
+                    std::chrono::seconds((vm.count("checkpoint-interval")) ? vm["checkpoint-interval"].as<int>() : 600),
+                    vm.count("resume") > 0};
+                if (checkpoint_options.resume && checkpoint_options.filename.empty()) {
+                    throw std::runtime_error("--resume needs --checkpoint");
+                }
+                solve(pos, depth, max_depth, tablebase.get(), num_threads, vm.count("speedup") > 0, stats_output, checkpoint_options);
+            } else {
+                throw std::runtime_error("Unknown solver");
+            }
         }
     }
     catch (const std::exception& e) {
@@ -70,15 +263,77 @@ int main(int argc, char *argv[])
 namespace
 {
 
-void solve(const Position& pos, int start_depth, int max_depth)
+void solve(const Position& pos,
+           int start_depth,
+           int max_depth,
+           const Tablebase* tablebase,
+           unsigned int num_threads,
+           bool show_speedup,
+           const StatsOutput& stats_output,
+           const CheckpointOptions& checkpoint_options)
 {
-    TranspositionTable tt(TT_BUCKETS, TT_SLOTS_PER_BUCKET);
-    int lower_bound = -1;
-    int upper_bound = 1;
+    std::vector<double> baseline_times;
+    if (show_speedup && num_threads > 1) {
+        std::cout << "Baseline with 1 thread:" << std::endl;
+        baseline_times = run_solver(pos, start_depth, max_depth, tablebase, 1, {}, {false, nullptr}, {"", {}, false});
+        std::cout << "With " << num_threads << " threads:" << std::endl;
+    }
+    run_solver(pos, start_depth, max_depth, tablebase, num_threads, baseline_times, stats_output, checkpoint_options);
+}
+
+
+// Returns the time taken by each depth.
+// If baseline_times is not empty, the speedup over it is printed for each depth.
+std::vector<double> run_solver(const Position& pos,
+                               int start_depth,
+                               int max_depth,
+                               const Tablebase* tablebase,
+                               unsigned int num_threads,
+                               const std::vector<double>& baseline_times,
+                               const StatsOutput& stats_output,
+                               const CheckpointOptions& checkpoint_options)
+{
+    std::vector<double> times;
+    TranspositionTable tt(TT_BUCKETS);
+    std::uint64_t last_interior_nodes = 0;
+    SolveState state = {position_to_fen(pos), start_depth - 1, -1, 1, {}};
+    if (checkpoint_options.resume) {
+        state = load_checkpoint(checkpoint_options.filename, tt);
+        if (state.pos_fen != position_to_fen(pos)) {
+            throw std::runtime_error("The checkpoint is for " + state.pos_fen);
+        }
+        std::cout << "Resuming after depth " << state.depth
+                  << "; score (" << state.lower_bound << ", " << state.upper_bound << ")"
+                  << "; pv " << variation_to_string(state.pv)
+                  << std::endl;
+        start_depth = std::max(start_depth, state.depth + 1);
+    }
+    std::unique_ptr<Checkpointer> checkpointer;
+    if (!checkpoint_options.filename.empty()) {
+        checkpointer = std::make_unique<Checkpointer>(checkpoint_options.filename, tt, checkpoint_options.interval, state);
+    }
+    int lower_bound = state.lower_bound;
+    int upper_bound = state.upper_bound;
     for (int depth = start_depth; lower_bound != upper_bound && depth <= max_depth; ++depth) {
         Variation pv;
         std::uint64_t before = now_in_microseconds();
-        SearchResult result = search_node(depth, pos, lower_bound, upper_bound, tt, pv);
+        CutoffStats cutoff_stats;
+        std::unique_ptr<SearchStats> stats;
+        if (stats_output.is_wanted()) {
+            stats = std::make_unique<SearchStats>();
+        }
+        int num_probes;
+        SearchResult result = null_window_search(depth,
+                                                 pos,
+                                                 lower_bound,
+                                                 upper_bound,
+                                                 tt,
+                                                 tablebase,
+                                                 num_threads,
+                                                 pv,
+                                                 cutoff_stats,
+                                                 stats.get(),
+                                                 num_probes);
         lower_bound = result.lower_bound;
         upper_bound = result.upper_bound;
         std::uint64_t after = now_in_microseconds();
@@ -89,41 +344,192 @@ void solve(const Position& pos, int start_depth, int max_depth)
                   << "; leaves " << result.num_leaves
                   << "; sec " << time_taken
                   << "; megaleaves/sec " << (leaves_sec/1'000'000)
-                  << "; pv " << variation_to_string(pv)
+                  << "; probes " << num_probes;
+        if (cutoff_stats.num_cutoffs > 0) {
+            std::cout << "; first-move cutoffs "
+                      << (100.0 * cutoff_stats.num_first_move_cutoffs / cutoff_stats.num_cutoffs) << "%";
+        }
+        if (times.size() < baseline_times.size()) {
+            std::cout << "; speedup " << baseline_times[times.size()]/time_taken;
+        }
+        std::cout << "; pv " << variation_to_string(pv)
                   << std::endl;
+        times.push_back(time_taken);
+        if (checkpointer) {
+            checkpointer->update({state.pos_fen, depth, lower_bound, upper_bound, pv});
+        }
+
+        if (stats) {
+            // The effective branching factor: how many times bigger this depth's tree was than the last one's
+            std::uint64_t interior_nodes = stats->total_interior_nodes();
+            double ebf = last_interior_nodes ? double(interior_nodes) / last_interior_nodes : 0;
+            last_interior_nodes = interior_nodes;
+            double tt_occupancy = tt.occupancy();
+            if (stats_output.print) {
+                print_stats(*stats, cutoff_stats, ebf, tt_occupancy);
+            }
+            if (stats_output.json) {
+                write_stats_json(*stats_output.json, depth, *stats, cutoff_stats, ebf, tt_occupancy);
+            }
+        }
     }
 
+    if (checkpointer) {
+        checkpointer->save_now();
+    }
     if (lower_bound == upper_bound) {
-        // The position is solved
-        switch (lower_bound) {
-        case -1:
-            std::cout << "Black wins.";
-            break;
+        print_verdict(lower_bound);
+    } else {
+        std::cout << "Maximum search depth reached." << std::endl;
+    }
+
+    return times;
+}
 
-        case 0:
-            std::cout << "The position is drawn.";
+
+void print_stats(const SearchStats& stats, const CutoffStats& cutoff_stats, double ebf, double tt_occupancy)
+{
+    auto percent = [](std::uint64_t part, std::uint64_t whole) -> double {
+        return whole ? 100.0 * part / whole : 0;
+    };
+    std::cout << "    interior nodes " << stats.total_interior_nodes() << " by ply:";
+    std::size_t num_plies = MAX_DEPTH + 1;
+    while (num_plies > 0 && stats.interior_nodes[num_plies - 1] == 0) {
+        --num_plies;
+    }
+    for (std::size_t ply = 0; ply < num_plies; ++ply) {
+        std::cout << " " << stats.interior_nodes[ply];
+    }
+    std::cout << "; ebf " << ebf << std::endl;
+    std::cout << "    tt probes " << stats.tt_probes
+              << "; hits " << percent(stats.tt_hits, stats.tt_probes) << "%"
+              << "; cutoffs " << percent(stats.tt_cutoffs, stats.tt_probes) << "%"
+              << "; collisions " << stats.tt_collisions
+              << "; overwrites " << stats.tt_overwrites
+              << "; occupancy " << 100 * tt_occupancy << "%" << std::endl;
+    std::cout << "    beta cutoffs " << cutoff_stats.num_cutoffs
+              << "; on first move " << percent(cutoff_stats.num_first_move_cutoffs, cutoff_stats.num_cutoffs) << "%"
+              << std::endl;
+}
+
+// One line per depth, so the file is JSON lines
+void write_stats_json(std::ostream& out,
+                      int depth,
+                      const SearchStats& stats,
+                      const CutoffStats& cutoff_stats,
+                      double ebf,
+                      double tt_occupancy)
+{
+    out << "{\"depth\": " << depth
+        << ", \"interior_nodes\": " << stats.total_interior_nodes()
+        << ", \"interior_nodes_by_ply\": [";
+    std::size_t num_plies = MAX_DEPTH + 1;
+    while (num_plies > 0 && stats.interior_nodes[num_plies - 1] == 0) {
+        --num_plies;
+    }
+    for (std::size_t ply = 0; ply < num_plies; ++ply) {
+        out << (ply ? ", " : "") << stats.interior_nodes[ply];
+    }
+    out << "]"
+        << ", \"ebf\": " << ebf
+        << ", \"tt_probes\": " << stats.tt_probes
+        << ", \"tt_hits\": " << stats.tt_hits
+        << ", \"tt_cutoffs\": " << stats.tt_cutoffs
+        << ", \"tt_collisions\": " << stats.tt_collisions
+        << ", \"tt_overwrites\": " << stats.tt_overwrites
+        << ", \"tt_occupancy\": " << tt_occupancy
+        << ", \"beta_cutoffs\": " << cutoff_stats.num_cutoffs
+        << ", \"first_move_cutoffs\": " << cutoff_stats.num_first_move_cutoffs
+        << "}" << std::endl;
+}
+
+
+// Solves the position by asking proof-number search whether the side to move wins,
+// and if not, whether it at least draws
+void prove(const Position& pos, const std::string& solver, const Tablebase* tablebase)
+{
+    TranspositionTable tt(TT_BUCKETS);
+    ProofTable proof_table(PROOF_TABLE_BUCKETS);
+    SearchContext context = {tt, nullptr, tablebase};
+    int score = -1;
+    for (int threshold = 1; threshold >= 0; --threshold) {
+        std::uint64_t before = now_in_microseconds();
+        ProofSearchResult result = (solver == "pns") ? pns_prove(pos, threshold, context, PNS_MAX_NODES)
+                                                     : dfpn_prove(pos, threshold, context, proof_table);
+        std::uint64_t after = now_in_microseconds();
+        double time_taken = (after - before) / 1'000'000.0;
+        std::cout << "score >= " << threshold << ": ";
+        switch (result.result) {
+        case ProofResult::PROVEN:
+            std::cout << "proven";
             break;
 
-        case 1:
-            std::cout << "White wins.";
+        case ProofResult::DISPROVEN:
+            std::cout << "disproven";
             break;
 
-        default:
-            std::cout << "Something went horribly wrong!";
+        case ProofResult::UNKNOWN:
+            std::cout << "unknown";
+            break;
+        }
+        std::cout << "; nodes " << result.num_nodes
+                  << "; sec " << time_taken
+                  << "; line " << variation_to_string(result.line)
+                  << std::endl;
+        if (result.result == ProofResult::UNKNOWN) {
+            std::cout << "Ran out of room for the proof tree." << std::endl;
+            return;
+        }
+        if (result.result == ProofResult::PROVEN) {
+            score = threshold;
+            break;
         }
-    } else {
-        std::cout << "Maximum search depth reached.";
+    }
+
+    print_verdict(score);
+}
+
+
+void print_verdict(int score)
+{
+    switch (score) {
+    case -1:
+        std::cout << "Black wins.";
+        break;
+
+    case 0:
+        std::cout << "The position is drawn.";
+        break;
+
+    case 1:
+        std::cout << "White wins.";
+        break;
+
+    default:
+        std::cout << "Something went horribly wrong!";
     }
 
     std::cout << std::endl;
 }
 
 
-void perft(const Position& pos, int start_depth, int max_depth, bool split)
+void perft(const Position& pos,
+           int start_depth,
+           int max_depth,
+           bool split,
+           PerftTable& table,
+           unsigned int num_threads,
+           PerftKernel kernel)
 {
     for (int depth = start_depth; depth <= max_depth; ++depth) {
         std::uint64_t before = now_in_microseconds();
-        std::vector<PerftMove> moves = split_perft_node(depth, pos);
+        std::vector<PerftMove> moves;
+        std::vector<std::uint64_t> thread_leaves;
+        if (num_threads > 1) {
+            moves = parallel_split_perft_node(depth, pos, table, num_threads, thread_leaves, kernel);
+        } else {
+            moves = split_perft_node(depth, pos, table, kernel);
+        }
         std::uint64_t after = now_in_microseconds();
         std::uint64_t num_leaves = 0;
         for (const PerftMove& move : moves) {
@@ -145,6 +551,11 @@ void perft(const Position& pos, int start_depth, int max_depth, bool split)
                           << std::endl;
             }
         }
+        for (std::size_t i = 0; i < thread_leaves.size(); ++i) {
+            std::cout << "    thread " << i << ": "
+                      << thread_leaves[i] << " leaves"
+                      << std::endl;
+        }
         if (num_leaves == 0) {
             break;
         }
@@ -152,71 +563,82 @@ void perft(const Position& pos, int start_depth, int max_depth, bool split)
 }
 
 
-Position parse_fen(const std::string& fen)
-{
-    Bitboard white_pawns = 0;
-    Bitboard black_pawns = 0;
-    std::regex re("([Xo1-8]+)/"
-                  "([Xo1-8]+)/"
-                  "([Xo1-8]+)/"
-                  "([Xo1-8]+)/"
-                  "([Xo1-8]+)/"
-                  "([Xo1-8]+)/"
-                  "([Xo1-8]+)/"
-                  "([Xo1-8]+)"
-                  " ([a-h][36]|-)");
-    std::smatch match;
-    if (!std::regex_match(fen, match, re)) {
-        throw std::exception("Position is in invalid format");
-    }
-    for (int i = 1; i <= 8; ++i) {
-        int num_columns = 0;
-        for (char ch : match[i].str()) {
-            int shift_count = 1;
-            int black_bit = 0;
-            int white_bit = 0;
-            if (ch == 'X') {
-                // It's a black pawn
-                black_bit = 1;              // gets shifted into black_pawns' LSB
-            } else if (ch == 'o') {
-                // It's a white pawn
-                white_bit = 1;
-            } else {
-                // It's a digit
-                shift_count = ch - '0';
-            }
-            black_pawns = (black_pawns << shift_count) | black_bit;
-            white_pawns = (white_pawns << shift_count) | white_bit;
-            num_columns += shift_count;
-        }
-        if (num_columns != 8) {
-            throw std::exception("Position is not 8x8");
+// The dedup ratio is how many children each distinct position had to be found among
+void unique_perft(const Position& pos, int max_depth, const UniquePerftOptions& options)
+{
+    ::unique_perft(pos, max_depth, options, [](const UniquePlyStats& stats) {
+        std::cout << "ply " << stats.ply
+                  << "; unique " << stats.num_unique
+                  << "; generated " << stats.num_generated
+                  << "; dedup ratio " << (stats.num_unique ? double(stats.num_generated) / stats.num_unique : 0)
+                  << "; spilled runs " << stats.num_spilled_runs
+                  << "; peak MiB " << stats.peak_bytes / (1024.0 * 1024.0)
+                  << "; sec " << stats.seconds
+                  << std::endl;
+    });
+}
+
+
+void compare_perft(const Position& pos, int start_depth, int max_depth)
+{
+    for (int depth = start_depth; depth <= max_depth; ++depth) {
+        std::uint64_t before = now_in_microseconds();
+        std::uint64_t num_leaves = compare_perft_node(depth, pos);
+        std::uint64_t after = now_in_microseconds();
+        double time_taken = (after - before) / 1'000'000.0;
+        std::cout << "depth " << depth
+                  << "; leaves " << num_leaves
+                  << "; sec " << time_taken
+                  << "; generators agree"
+                  << std::endl;
+        if (num_leaves == 0) {
+            break;
         }
     }
+}
 
-    std::string en_passant_str = match[9].str();
-    std::optional<unsigned int> en_passant;
-    if (en_passant_str != "-") {
-        en_passant = parse_coords(en_passant_str);
-    }
 
-    return {white_pawns, black_pawns, en_passant};
+// Classes with fewer pawns go first. Classes finished by an earlier run are skipped.
+void generate_tablebase(Tablebase& tablebase, unsigned int num_threads)
+{
+    int max_pawns = tablebase.max_pawns();
+    for (int total = 2; total <= 2*max_pawns; ++total) {
+        for (int my = std::max(1, total - max_pawns); my <= std::min(max_pawns, total - 1); ++my) {
+            int their = total - my;
+            std::cout << my << "v" << their << ": " << tablebase.num_positions(my, their) << " positions";
+            if (tablebase.is_complete(my, their)) {
+                std::cout << "; already done" << std::endl;
+                continue;
+            }
+            std::uint64_t before = now_in_microseconds();
+            tablebase.generate_class(my, their, num_threads);
+            std::uint64_t after = now_in_microseconds();
+            std::cout << "; sec " << (after - before) / 1'000'000.0 << std::endl;
+        }
+    }
 }
 
 
-// @TODO@ -- result has extra space at the end
-std::string variation_to_string(const Variation& variation)
+void hash_bench(const Position& pos, int start_depth, int max_depth)
 {
-    std::string out;
-    bool white = true;
-    for (const Move& move : variation) {
-        unsigned int xor = white ? 0 : 56;          // black's moves need to be flipped
-        out += bitnum_to_coords(move.src_bitnum ^ xor);
-        out += bitnum_to_coords(move.dest_bitnum ^ xor);
-        out += " ";
-        white = !white;
+    for (int depth = start_depth; depth <= max_depth; ++depth) {
+        std::vector<HashBenchResult> results = hash_benchmark(depth, pos);
+        std::cout << "depth " << depth
+                  << "; positions " << results[0].num_positions
+                  << "; expected low-32-bit collisions " << results[0].expected_low_collisions
+                  << std::endl;
+        for (const HashBenchResult& result : results) {
+            std::cout << "    " << result.backend_name
+                      << ": collisions " << result.num_collisions
+                      << "; low-32-bit collisions " << result.num_low_collisions
+                      << "; megahashes/sec " << (result.hashes_per_sec/1'000'000)
+                      << "; meganodes/sec " << (result.nodes_per_sec/1'000'000)
+                      << std::endl;
+        }
+        if (results[0].num_positions == 0) {
+            break;
+        }
     }
-    return out;
 }
 
 
@@ -0,0 +1,80 @@
+#include <algorithm>
+#include <cassert>
+#include "move_order.hpp"
+
+namespace
+{
+const int TT_MOVE_SCORE = 0x2000'0000;
+const int KILLER_SCORE = 0x1000'0000;           // minus the killer's index
+}
+
+
+MoveHistory::MoveHistory()
+  : m_killers(),
+    m_history()
+{
+}
+
+// depth is the depth left at the node that cut off; cutoffs nearer the root save more, so they count for more
+void MoveHistory::record_cutoff(const SearchMove& move, int depth, int ply)
+{
+    // Captures depend too much on where the enemy pawns are to make good killers
+    assert(ply >= 0 && ply < MAX_PLY);
+    if (!move.is_capture && m_killers[ply][0] != move.move) {
+        m_killers[ply][1] = m_killers[ply][0];
+        m_killers[ply][0] = move.move;
+    }
+
+    std::uint32_t& count = m_history[move.move.src_bitnum][move.move.dest_bitnum];
+    count += depth * depth;
+    if (count >= MAX_HISTORY) {
+        // Halve everything, which also lets old history fade
+        for (auto& row : m_history) {
+            for (std::uint32_t& other_count : row) {
+                other_count /= 2;
+            }
+        }
+    }
+}
+
+int MoveHistory::score(const SearchMove& move, int ply) const
+{
+    // An unset killer is a move from h1 to h1, which no pawn can make
+    for (int i = 0; i < 2; ++i) {
+        if (m_killers[ply][i] == move.move) {
+            return KILLER_SCORE - i;
+        }
+    }
+    return m_history[move.move.src_bitnum][move.move.dest_bitnum];
+}
+
+
+MovePicker::MovePicker(const MoveList& movelist,
+                       const std::optional<Move>& tt_move,
+                       const MoveHistory& history,
+                       int ply)
+  : m_movelist(movelist),
+    m_num_picked(0)
+{
+    for (std::size_t i = 0; i < movelist.size(); ++i) {
+        m_scores[i] = (tt_move && movelist[i].move == *tt_move) ? TT_MOVE_SCORE : history.score(movelist[i], ply);
+        m_indexes[i] = static_cast<std::uint8_t>(i);
+    }
+}
+
+// Selection sort, one step at a time
+const SearchMove* MovePicker::next()
+{
+    if (m_num_picked == m_movelist.size()) {
+        return nullptr;
+    }
+    unsigned int best = m_num_picked;
+    for (unsigned int i = m_num_picked + 1; i < m_movelist.size(); ++i) {
+        if (m_scores[i] > m_scores[best]) {
+            best = i;
+        }
+    }
+    std::swap(m_scores[best], m_scores[m_num_picked]);
+    std::swap(m_indexes[best], m_indexes[m_num_picked]);
+    return &m_movelist[m_indexes[m_num_picked++]];
+}
@@ -0,0 +1,63 @@
+#ifndef PEASANT_MOVE_ORDER_HPP
+#define PEASANT_MOVE_ORDER_HPP
+
+#include <cstdint>
+#include <optional>
+#include "movegen.hpp"
+#include "position.hpp"
+
+// How many nodes the search cut off at, and at how many of them the first move searched did it.
+// The closer the two are, the better the moves are ordered.
+struct CutoffStats
+{
+    std::uint64_t num_cutoffs = 0;
+    std::uint64_t num_first_move_cutoffs = 0;
+
+    CutoffStats& operator+=(const CutoffStats& rhs) {
+        num_cutoffs += rhs.num_cutoffs;
+        num_first_move_cutoffs += rhs.num_first_move_cutoffs;
+        return *this;
+    }
+};
+
+
+// What a search thread has learned about which moves cause cutoffs: the last two quiet (non-capture)
+// moves to do it at each ply (the killers), and how much each move has done it over the
+// whole search, by source and destination square (the history)
+class MoveHistory
+{
+public:
+    static const int MAX_PLY = 256;
+
+    MoveHistory();
+    void record_cutoff(const SearchMove& move, int depth, int ply);
+    int score(const SearchMove& move, int ply) const;
+
+private:
+    // History counts are kept below this, so that they rank under the killers
+    static const std::uint32_t MAX_HISTORY = 0x0100'0000;
+
+    Move m_killers[MAX_PLY][2];
+    std::uint32_t m_history[64][64];            // [src_bitnum][dest_bitnum]
+};
+
+
+// Hands out a node's moves best first: the TT's best move, then killers, then the rest by history.
+// (Putting captures first, as the search used to, cuts off on the first move less often.)
+// Each move is picked only when the search asks for it, since after a cutoff the rest are never looked at.
+class MovePicker
+{
+public:
+    MovePicker(const MoveList& movelist, const std::optional<Move>& tt_move, const MoveHistory& history, int ply);
+
+    // Returns null once every move has been picked
+    const SearchMove* next();
+
+private:
+    const MoveList& m_movelist;
+    unsigned int m_num_picked;
+    int m_scores[MAX_BRANCHES];
+    std::uint8_t m_indexes[MAX_BRANCHES];       // m_indexes[i] is the move whose score is m_scores[i]
+};
+
+#endif
@@ -0,0 +1,166 @@
+#include <algorithm>
+#include <cassert>
+#include "movegen.hpp"
+
+namespace
+{
+bool try_advance(MoveList& movelist, const Position& pos, unsigned int bitnum, unsigned int num_squares);
+void try_capture(MoveList& movelist, const Position& pos, unsigned int bitnum, int direction, Bitboard en_passant_bit);
+}
+
+
+// This function only generates moves in the order they're found; no ordering is done.
+void gen_moves(MoveList& movelist, const Position& pos)
+{
+    auto push = [&movelist](const SearchMove& move, auto) {
+        movelist.push_back(move);
+    };
+    if (pos.has_en_passant()) {
+        visit_moves<true>(pos, push);
+    } else {
+        visit_moves<false>(pos, push);
+    }
+}
+
+// Returns the number of moves gen_moves would generate, without generating them
+unsigned int count_moves(const Position& pos)
+{
+    return pos.has_en_passant() ? count_moves<true>(pos) : count_moves<false>(pos);
+}
+
+// The original square-by-square generator. It's slow, but it's simple enough to trust,
+// so it's kept around to check gen_moves against.
+void gen_moves_reference(MoveList& movelist, const Position& pos)
+{
+    for (unsigned int bitnum = 8; bitnum < 56; ++bitnum) {
+        Bitboard bit = 1ULL << bitnum;
+        if (pos.my_pawns & bit) {
+            // We've found one of my pawns.
+            // Try a one-square advance
+            bool can_advance = try_advance(movelist, pos, bitnum, 1);
+
+            // If successful, try a two-square advance if on second rank
+            if (can_advance && bitnum < 16) {
+                try_advance(movelist, pos, bitnum, 2);
+            }
+
+            Bitboard en_passant_bit = pos.en_passant_bit();
+            unsigned int column = bitnum % 8;       // 0 = rightmost column; 7 = leftmost
+            // Don't test invalid captures (leftward capture on leftmost column, etc.)
+            if (column != 7) {
+                try_capture(movelist, pos, bitnum, -1, en_passant_bit);
+            }
+            if (column != 0) {
+                try_capture(movelist, pos, bitnum, 1, en_passant_bit);
+            }
+        }
+    }
+}
+
+// Returns true if both lists hold the same moves, regardless of order
+bool same_moves(const MoveList& a, const MoveList& b)
+{
+    if (a.size() != b.size()) {
+        return false;
+    }
+    auto by_squares = [](const SearchMove& x, const SearchMove& y) -> bool {
+        return x.move.src_bitnum < y.move.src_bitnum ||
+               (x.move.src_bitnum == y.move.src_bitnum && x.move.dest_bitnum < y.move.dest_bitnum);
+    };
+    MoveList sorted_a = a;
+    MoveList sorted_b = b;
+    std::sort(sorted_a.begin(), sorted_a.end(), by_squares);
+    std::sort(sorted_b.begin(), sorted_b.end(), by_squares);
+    for (std::size_t i = 0; i < sorted_a.size(); ++i) {
+        const SearchMove& x = sorted_a[i];
+        const SearchMove& y = sorted_b[i];
+        if (x.new_pos != y.new_pos ||
+            x.move.src_bitnum != y.move.src_bitnum ||
+            x.move.dest_bitnum != y.move.dest_bitnum ||
+            x.is_capture != y.is_capture) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// Rotates the bitboards so that my_pawns and their_pawns are switched and vertically flipped
+// Equivalent to rotating by 180 degrees, except the board is horizontally mirrored
+// (we do this instead of the full rotation because it's faster)
+// The en passant marker needs no help: it goes from one side's last rank to the other side's first and back.
+Position flip_board(const Position& pos)
+{
+    return {vflip_bitboard(pos.their_pawns), vflip_bitboard(pos.my_pawns)};
+}
+
+// Mirrors the board left to right. The rules don't care, so a position and its mirror have the same score.
+Position mirror_board(const Position& pos)
+{
+    return {mirror_bitboard(pos.my_pawns), mirror_bitboard(pos.their_pawns)};
+}
+
+Move mirror_move(const Move& move)
+{
+    return to_move(move.src_bitnum ^ 7, move.dest_bitnum ^ 7);
+}
+
+// True if the position is its own mirror. No square is its own mirror,
+// so a position with an en passant square never is.
+bool is_symmetric(const Position& pos)
+{
+    return pos.my_pawns == mirror_bitboard(pos.my_pawns) &&
+           pos.their_pawns == mirror_bitboard(pos.their_pawns);
+}
+
+
+namespace
+{
+
+// Only checks if the destination is occupied; two-square advances do not check if a pawn is in the way!
+// (This should be done by only calling after checking the result of a one-square advance)
+// Returns true if the square was unoccupied
+bool try_advance(MoveList& movelist,
+                 const Position& pos,
+                 unsigned int bitnum,
+                 unsigned int num_squares)
+{
+    unsigned int dest_bitnum = bitnum+8*num_squares;
+    Bitboard all_pawns = pos.my_pawns | pos.their_pawns_only();
+    Bitboard bit = 1ULL << bitnum;
+    Bitboard dest = 1ULL << dest_bitnum;
+    if (!(all_pawns & dest)) {
+        // The destination is empty; we can advance
+        Bitboard my_new_pawns = (pos.my_pawns | dest) & ~bit;
+        if (num_squares == 2) {
+            // Leave the opponent an en passant square, marked on my first rank (see SearchMove)
+            my_new_pawns |= bit >> 8;
+        }
+        SearchMove move = {{my_new_pawns, pos.their_pawns_only()}, to_move(bitnum, dest_bitnum), false};
+        movelist.push_back(move);
+        return true;
+    }
+    return false;
+}
+
+void try_capture(MoveList& movelist,
+                 const Position& pos,
+                 unsigned int bitnum,
+                 int direction,                     // -1 = leftward; 1 = rightward
+                 Bitboard en_passant_bit)
+{
+    unsigned int dest_bitnum = bitnum + 8 - direction;
+    Bitboard bit = 1ULL << bitnum;
+    Bitboard dest = 1ULL << dest_bitnum;
+    assert(dest != 0);
+    if ((pos.their_pawns_only() & dest) || dest == en_passant_bit) {
+        // Capture is possible
+        Bitboard my_new_pawns = (pos.my_pawns | dest) & ~bit;
+        Bitboard captured_pawn = (dest == en_passant_bit) ? dest >> 8 : dest;
+        Bitboard their_new_pawns = pos.their_pawns_only() & ~captured_pawn;
+        SearchMove move = {{my_new_pawns, their_new_pawns}, to_move(bitnum, dest_bitnum), true};
+        movelist.push_back(move);
+    }
+}
+
+} // anon namespace
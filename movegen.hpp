@@ -0,0 +1,133 @@
+#ifndef PEASANT_MOVEGEN_HPP
+#define PEASANT_MOVEGEN_HPP
+
+#include <array>
+#include <type_traits>
+#include <boost/container/static_vector.hpp>
+#include "position.hpp"
+
+// The maximum number of moves that can be made in a turn (an overestimate)
+const int MAX_BRANCHES = 64;
+
+
+// new_pos is still from the mover's point of view (flip_board it to get the child), so an en passant square
+// the move leaves the opponent is marked on my_pawns' first rank rather than their_pawns' last.
+// With the compact Position and Move this is 24 bytes, so a full MoveList fits in 1.5 KiB.
+struct SearchMove
+{
+    Position new_pos;
+    Move move;
+    bool is_capture;
+};
+
+typedef boost::container::static_vector<SearchMove, MAX_BRANCHES> MoveList;
+
+
+// For each en passant square, the squares a pawn could capture onto it from
+inline constexpr std::array<Bitboard, 64> EN_PASSANT_CAPTURERS = [] {
+    std::array<Bitboard, 64> capturers = {};
+    for (unsigned int bitnum = 0; bitnum < 64; ++bitnum) {
+        Bitboard dest = 1ULL << bitnum;
+        capturers[bitnum] = ((dest >> 9) & ~FILE_A) | ((dest >> 7) & ~FILE_H);
+    }
+    return capturers;
+}();
+
+
+void gen_moves(MoveList& movelist, const Position& pos);
+unsigned int count_moves(const Position& pos);
+
+// The kernels behind gen_moves and count_moves, for callers that know at compile time
+// whether the position has an en passant square (HAS_EN_PASSANT has to say truly).
+//
+// visit_moves calls visit(move, child_has_en_passant) for each move gen_moves would generate, in the same order.
+// child_has_en_passant is std::true_type for two-square advances and std::false_type otherwise,
+// so a visitor that recurses can pick its child's specialization without looking.
+template<bool HAS_EN_PASSANT, typename Visit> void visit_moves(const Position& pos, Visit&& visit);
+template<bool HAS_EN_PASSANT> unsigned int count_moves(const Position& pos);
+
+void gen_moves_reference(MoveList& movelist, const Position& pos);
+bool same_moves(const MoveList& a, const MoveList& b);
+Position flip_board(const Position& pos);
+Position mirror_board(const Position& pos);
+Move mirror_move(const Move& move);
+bool is_symmetric(const Position& pos);
+
+
+// Each kind of move is found for all pawns at once by shifting the whole bitboard,
+// then the moves are pulled out of the resulting bitboards one bit at a time.
+template<bool HAS_EN_PASSANT, typename Visit>
+void visit_moves(const Position& pos, Visit&& visit)
+{
+    // The old square-by-square generator never looked at pawns on the first or last rank, so neither do we
+    Bitboard pawns = pos.my_pawns & ~(RANK_1 | RANK_8);
+    // Leaving the en passant marker off their pawns also keeps it out of every child
+    Bitboard their_pawns = pos.their_pawns_only();
+    Bitboard empty = ~(pos.my_pawns | their_pawns);
+
+    Bitboard single_advances = (pawns << 8) & empty;
+    Bitboard double_advances = ((single_advances & RANK_3) << 8) & empty;
+    Bitboard left_captures = ((pawns & ~FILE_A) << 9) & their_pawns;
+    Bitboard right_captures = ((pawns & ~FILE_H) << 7) & their_pawns;
+
+    for (; single_advances; single_advances &= single_advances - 1) {
+        unsigned int dest_bitnum = lowest_bitnum(single_advances);
+        unsigned int src_bitnum = dest_bitnum - 8;
+        Bitboard my_new_pawns = pos.my_pawns ^ (0x101ULL << src_bitnum);
+        visit(SearchMove{{my_new_pawns, their_pawns}, to_move(src_bitnum, dest_bitnum), false}, std::false_type());
+    }
+    for (; double_advances; double_advances &= double_advances - 1) {
+        // The opponent's en passant marker goes on my first rank, which is their rank 8 once the board is flipped
+        unsigned int dest_bitnum = lowest_bitnum(double_advances);
+        unsigned int src_bitnum = dest_bitnum - 16;
+        Bitboard my_new_pawns = pos.my_pawns ^ (0x100'0101ULL << (src_bitnum - 8));
+        visit(SearchMove{{my_new_pawns, their_pawns}, to_move(src_bitnum, dest_bitnum), false}, std::true_type());
+    }
+    for (; left_captures; left_captures &= left_captures - 1) {
+        unsigned int dest_bitnum = lowest_bitnum(left_captures);
+        unsigned int src_bitnum = dest_bitnum - 9;
+        Bitboard my_new_pawns = pos.my_pawns ^ (0x201ULL << src_bitnum);
+        Bitboard their_new_pawns = their_pawns ^ (1ULL << dest_bitnum);
+        visit(SearchMove{{my_new_pawns, their_new_pawns}, to_move(src_bitnum, dest_bitnum), true}, std::false_type());
+    }
+    for (; right_captures; right_captures &= right_captures - 1) {
+        unsigned int dest_bitnum = lowest_bitnum(right_captures);
+        unsigned int src_bitnum = dest_bitnum - 7;
+        Bitboard my_new_pawns = pos.my_pawns ^ (0x81ULL << src_bitnum);
+        Bitboard their_new_pawns = their_pawns ^ (1ULL << dest_bitnum);
+        visit(SearchMove{{my_new_pawns, their_new_pawns}, to_move(src_bitnum, dest_bitnum), true}, std::false_type());
+    }
+
+    if constexpr (HAS_EN_PASSANT) {
+        // Work backwards from the en passant square to the (at most two) pawns that can capture onto it
+        unsigned int dest_bitnum = pos.en_passant_bitnum();
+        Bitboard dest = 1ULL << dest_bitnum;
+        Bitboard capturers = pawns & EN_PASSANT_CAPTURERS[dest_bitnum];
+        Bitboard their_new_pawns = their_pawns ^ (dest >> 8);
+        for (; capturers; capturers &= capturers - 1) {
+            unsigned int src_bitnum = lowest_bitnum(capturers);
+            Bitboard my_new_pawns = pos.my_pawns ^ (dest | 1ULL << src_bitnum);
+            visit(SearchMove{{my_new_pawns, their_new_pawns}, to_move(src_bitnum, dest_bitnum), true}, std::false_type());
+        }
+    }
+}
+
+template<bool HAS_EN_PASSANT>
+unsigned int count_moves(const Position& pos)
+{
+    Bitboard pawns = pos.my_pawns & ~(RANK_1 | RANK_8);
+    Bitboard their_pawns = pos.their_pawns_only();
+    Bitboard empty = ~(pos.my_pawns | their_pawns);
+    Bitboard targets = their_pawns;
+    if constexpr (HAS_EN_PASSANT) {
+        targets |= pos.en_passant_bit();
+    }
+
+    Bitboard single_advances = (pawns << 8) & empty;
+    Bitboard double_advances = ((single_advances & RANK_3) << 8) & empty;
+    Bitboard left_captures = ((pawns & ~FILE_A) << 9) & targets;
+    Bitboard right_captures = ((pawns & ~FILE_H) << 7) & targets;
+    return popcount(single_advances) + popcount(double_advances) + popcount(left_captures) + popcount(right_captures);
+}
+
+#endif
@@ -0,0 +1,96 @@
+#include <algorithm>
+#include "null_window.hpp"
+
+namespace
+{
+template<typename Probe> SearchResult run_probes(int lower_bound, int upper_bound, Variation& pv, int& num_probes, Probe probe);
+}
+
+
+// Narrows what's known about the score, (lower_bound, upper_bound), as far as a search to this depth can.
+// A score can only be -1, 0 or 1, so that takes at most two null-window probes:
+// "is it above 0?" and "is it below 0?" (MTD-style). A null window cuts off far more than (-1, 1) does,
+// and the second probe gets to reuse whatever the first left in the TT.
+// The returned bounds include what was known before; num_leaves and cutoff_stats are totals over the probes,
+// and so is what gets added to stats (if not null).
+// pv is from the last probe that found one.
+SearchResult null_window_search(int depth,
+                                const Position& pos,
+                                int lower_bound,
+                                int upper_bound,
+                                TranspositionTable& tt,
+                                const Tablebase* tablebase,
+                                unsigned int num_threads,
+                                Variation& pv,
+                                CutoffStats& cutoff_stats,
+                                SearchStats* stats,
+                                int& num_probes)
+{
+    cutoff_stats = {};
+    return run_probes(lower_bound, upper_bound, pv, num_probes, [&](int beta, Variation& probe_pv) {
+        CutoffStats probe_cutoff_stats;
+        SearchResult result = lazy_smp_search(depth,
+                                              pos,
+                                              beta - 1,
+                                              beta,
+                                              tt,
+                                              tablebase,
+                                              num_threads,
+                                              probe_pv,
+                                              probe_cutoff_stats,
+                                              stats);
+        cutoff_stats += probe_cutoff_stats;
+        return result;
+    });
+}
+
+// The same on the calling thread, with a context the caller keeps between searches
+SearchResult null_window_search(int depth,
+                                const Position& pos,
+                                const PositionHash& hash,
+                                int lower_bound,
+                                int upper_bound,
+                                SearchContext& context,
+                                Variation& pv,
+                                int& num_probes)
+{
+    return run_probes(lower_bound, upper_bound, pv, num_probes, [&](int beta, Variation& probe_pv) {
+        SearchResult result = search_node(depth, pos, hash, beta - 1, beta, context);
+        probe_pv = context.pv_table.line(context.ply);
+        return result;
+    });
+}
+
+
+namespace
+{
+
+// probe(beta, probe_pv) searches with the null window (beta - 1, beta)
+template<typename Probe>
+SearchResult run_probes(int lower_bound, int upper_bound, Variation& pv, int& num_probes, Probe probe)
+{
+    SearchResult result = {lower_bound, upper_bound, 0};
+    num_probes = 0;
+
+    // Each probe tests the score against beta: it's >= beta if the result's lower bound reaches it,
+    // and < beta if the upper bound falls below it
+    for (int beta : {1, 0}) {
+        if (result.lower_bound >= beta || result.upper_bound < beta) {
+            // Already known
+            continue;
+        }
+        Variation probe_pv;
+        SearchResult probe_result = probe(beta, probe_pv);
+        ++num_probes;
+        result.lower_bound = std::max(result.lower_bound, probe_result.lower_bound);
+        result.upper_bound = std::min(result.upper_bound, probe_result.upper_bound);
+        result.num_leaves += probe_result.num_leaves;
+        if (!probe_pv.empty()) {
+            pv = probe_pv;
+        }
+    }
+
+    return result;
+}
+
+} // anon namespace
@@ -0,0 +1,29 @@
+#ifndef PEASANT_NULL_WINDOW_HPP
+#define PEASANT_NULL_WINDOW_HPP
+
+#include "lazy_smp.hpp"
+#include "position.hpp"
+#include "search.hpp"
+#include "tt.hpp"
+
+SearchResult null_window_search(int depth,
+                                const Position& pos,
+                                int lower_bound,
+                                int upper_bound,
+                                TranspositionTable& tt,
+                                const Tablebase* tablebase,
+                                unsigned int num_threads,
+                                Variation& pv,
+                                CutoffStats& cutoff_stats,
+                                SearchStats* stats,
+                                int& num_probes);
+SearchResult null_window_search(int depth,
+                                const Position& pos,
+                                const PositionHash& hash,
+                                int lower_bound,
+                                int upper_bound,
+                                SearchContext& context,
+                                Variation& pv,
+                                int& num_probes);
+
+#endif
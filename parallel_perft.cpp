@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include "movegen.hpp"
+#include "parallel_perft.hpp"
+#include "threadpool.hpp"
+
+// How many plies below the root the tree is split into tasks.
+// From the starting position, three plies gives 582 tasks, plenty to keep the threads busy.
+const int PERFT_SPLIT_PLY = 3;
+
+namespace
+{
+void add_subtree_tasks(WorkStealingPool& pool,
+                       int split_ply,
+                       int depth,
+                       const Position& pos,
+                       PerftTable& table,
+                       PerftKernel kernel,
+                       std::atomic<std::uint64_t>& move_leaves,
+                       std::vector<std::uint64_t>& thread_leaves);
+}
+
+
+// Gives the same results as split_perft_node, but the tree is cut up a few plies below the root
+// and the subtrees are counted on a work-stealing thread pool.
+// thread_leaves receives the number of leaves counted by each thread.
+std::vector<PerftMove> parallel_split_perft_node(int depth,
+                                                 const Position& pos,
+                                                 PerftTable& table,
+                                                 unsigned int num_threads,
+                                                 std::vector<std::uint64_t>& thread_leaves,
+                                                 PerftKernel kernel)
+{
+    std::vector<PerftMove> result;
+    WorkStealingPool pool(num_threads);
+    thread_leaves.assign(pool.num_threads(), 0);
+
+    if (depth == 0) {
+        return result;
+    }
+
+    MoveList movelist;
+    gen_moves(movelist, pos);
+
+    // Below the root, split as deep as we can without running past the leaves
+    int split_ply = std::clamp(depth - 2, 0, PERFT_SPLIT_PLY - 1);
+    std::unique_ptr<std::atomic<std::uint64_t>[]> move_leaves(new std::atomic<std::uint64_t>[movelist.size()]);
+    for (std::size_t i = 0; i < movelist.size(); ++i) {
+        move_leaves[i] = 0;
+        add_subtree_tasks(pool, split_ply, depth - 1, flip_board(movelist[i].new_pos), table, kernel, move_leaves[i], thread_leaves);
+    }
+
+    pool.run();
+
+    for (std::size_t i = 0; i < movelist.size(); ++i) {
+        PerftMove perft_move = {movelist[i].move, move_leaves[i]};
+        result.push_back(perft_move);
+    }
+
+    return result;
+}
+
+
+namespace
+{
+
+// Adds one task for every position split_ply plies below pos
+void add_subtree_tasks(WorkStealingPool& pool,
+                       int split_ply,
+                       int depth,
+                       const Position& pos,
+                       PerftTable& table,
+                       PerftKernel kernel,
+                       std::atomic<std::uint64_t>& move_leaves,
+                       std::vector<std::uint64_t>& thread_leaves)
+{
+    if (split_ply == 0) {
+        pool.add_task([depth, pos, &table, kernel, &move_leaves, &thread_leaves](unsigned int thread_index) {
+            std::uint64_t num_leaves = kernel(depth, pos, table);
+            move_leaves += num_leaves;
+            thread_leaves[thread_index] += num_leaves;      // each thread has its own element
+        });
+        return;
+    }
+
+    MoveList movelist;
+    gen_moves(movelist, pos);
+    for (const SearchMove& move : movelist) {
+        add_subtree_tasks(pool, split_ply - 1, depth - 1, flip_board(move.new_pos), table, kernel, move_leaves, thread_leaves);
+    }
+}
+
+} // anon namespace
@@ -0,0 +1,16 @@
+#ifndef PEASANT_PARALLEL_PERFT_HPP
+#define PEASANT_PARALLEL_PERFT_HPP
+
+#include <vector>
+#include "position.hpp"
+#include "search.hpp"
+#include "tt.hpp"
+
+std::vector<PerftMove> parallel_split_perft_node(int depth,
+                                                 const Position& pos,
+                                                 PerftTable& table,
+                                                 unsigned int num_threads,
+                                                 std::vector<std::uint64_t>& thread_leaves,
+                                                 PerftKernel kernel = perft_node);
+
+#endif
@@ -0,0 +1,282 @@
+#include "hash.hpp"
+#include "movegen.hpp"
+#include "perft_batch.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define PEASANT_X86_SIMD
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// The kernels are compiled for their instruction sets whatever the build targets, and picked at run time
+#if defined(PEASANT_X86_SIMD) && defined(__GNUC__)
+#define PEASANT_TARGET(isa) __attribute__((target(isa)))
+#else
+#define PEASANT_TARGET(isa)
+#endif
+
+namespace
+{
+// The masks for the side moving down the board. Positions are only vertically flipped between plies,
+// so the files are the same as in the mover's own orientation, and ranks 1 and 8 swap over.
+constexpr Bitboard MOVER_RANK_3 = 0x0000'ff00'0000'0000ULL;
+constexpr Bitboard MOVER_BACK_RANKS = RANK_1 | RANK_8;
+
+typedef std::uint64_t (*LeafKernel)(const Bitboard* movers, const Bitboard* others, const Bitboard* en_passant, std::size_t size);
+
+template<bool WITH_TABLE, bool HAS_EN_PASSANT> void batched_perft_impl(int depth,
+                                                                       const Position& pos,
+                                                                       PerftTable& table,
+                                                                       LeafBatch& batch);
+std::uint64_t count_leaves_scalar(const Bitboard* movers, const Bitboard* others, const Bitboard* en_passant, std::size_t size);
+#ifdef PEASANT_X86_SIMD
+PEASANT_TARGET("avx2") __m256i byte_popcounts(__m256i v);
+PEASANT_TARGET("avx2") std::uint64_t count_leaves_avx2(const Bitboard* movers,
+                                                        const Bitboard* others,
+                                                        const Bitboard* en_passant,
+                                                        std::size_t size);
+PEASANT_TARGET("avx512f,avx512vpopcntdq") std::uint64_t count_leaves_avx512(const Bitboard* movers,
+                                                                             const Bitboard* others,
+                                                                             const Bitboard* en_passant,
+                                                                             std::size_t size);
+#endif
+LeafKernel choose_kernel(const char*& name);
+
+const char* kernel_name;
+const LeafKernel count_leaves = choose_kernel(kernel_name);
+}
+
+
+// The table (if enabled) is used at every node from two plies above the leaves up.
+// Those nodes need their own counts to store, so they flush the batch, but it's still shared by all their children.
+std::uint64_t batched_perft_node(int depth, const Position& pos, PerftTable& table)
+{
+    if (depth == 0) {
+        return 1;
+    }
+    if (depth == 1) {
+        return count_moves(pos);
+    }
+    LeafBatch batch;
+    bool has_en_passant = pos.has_en_passant();
+    if (table.is_enabled()) {
+        has_en_passant ? batched_perft_impl<true, true>(depth, pos, table, batch)
+                       : batched_perft_impl<true, false>(depth, pos, table, batch);
+    } else {
+        has_en_passant ? batched_perft_impl<false, true>(depth, pos, table, batch)
+                       : batched_perft_impl<false, false>(depth, pos, table, batch);
+    }
+    return batch.total();
+}
+
+const char* leaf_kernel_name()
+{
+    return kernel_name;
+}
+
+
+LeafBatch::LeafBatch()
+  : m_size(0),
+    m_total(0)
+{
+}
+
+void LeafBatch::flush()
+{
+    if (m_size) {
+        m_total += count_leaves(m_movers, m_others, m_en_passant, m_size);
+        m_size = 0;
+    }
+}
+
+
+namespace
+{
+
+// depth is at least 2. Adds the leaves below pos to the batch.
+template<bool WITH_TABLE, bool HAS_EN_PASSANT>
+void batched_perft_impl(int depth, const Position& pos, PerftTable& table, LeafBatch& batch)
+{
+    std::uint64_t hash = 0;
+    std::uint64_t before = 0;
+    if constexpr (WITH_TABLE) {
+        hash = calc_canonical_hash(pos);
+        std::uint64_t num_leaves;
+        if (table.fetch(hash, depth, num_leaves)) {
+            batch.add_leaves(num_leaves);
+            return;
+        }
+        before = batch.total();
+    }
+
+    if (depth == 2) {
+        visit_moves<HAS_EN_PASSANT>(pos, [&](const SearchMove& move, auto) {
+            batch.add(move.new_pos);
+        });
+    } else {
+        visit_moves<HAS_EN_PASSANT>(pos, [&](const SearchMove& move, auto child_has_en_passant) {
+            batched_perft_impl<WITH_TABLE, decltype(child_has_en_passant)::value>(depth - 1,
+                                                                                  flip_board(move.new_pos),
+                                                                                  table,
+                                                                                  batch);
+        });
+    }
+
+    if constexpr (WITH_TABLE) {
+        table.insert(hash, depth, batch.total() - before);
+    }
+}
+
+
+// count_moves, for the side moving down the board
+std::uint64_t count_leaves_scalar(const Bitboard* movers, const Bitboard* others, const Bitboard* en_passant, std::size_t size)
+{
+    std::uint64_t total = 0;
+    for (std::size_t i = 0; i < size; ++i) {
+        Bitboard pawns = movers[i] & ~MOVER_BACK_RANKS;
+        Bitboard empty = ~(movers[i] | others[i]);
+        Bitboard targets = others[i] | en_passant[i];
+        Bitboard single_advances = (pawns >> 8) & empty;
+        Bitboard double_advances = ((single_advances & MOVER_RANK_3) >> 8) & empty;
+        Bitboard left_captures = ((pawns & ~FILE_A) >> 7) & targets;
+        Bitboard right_captures = ((pawns & ~FILE_H) >> 9) & targets;
+        total += popcount(single_advances) + popcount(double_advances) + popcount(left_captures) + popcount(right_captures);
+    }
+    return total;
+}
+
+
+#ifdef PEASANT_X86_SIMD
+
+// AVX2 has no 64-bit popcount, so each byte is counted by looking up its nibbles in a shuffle
+__m256i byte_popcounts(__m256i v)
+{
+    const __m256i nibble_counts = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                                   0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_nibbles = _mm256_set1_epi8(0x0f);
+    __m256i low = _mm256_shuffle_epi8(nibble_counts, _mm256_and_si256(v, low_nibbles));
+    __m256i high = _mm256_shuffle_epi8(nibble_counts, _mm256_and_si256(_mm256_srli_epi16(v, 4), low_nibbles));
+    return _mm256_add_epi8(low, high);
+}
+
+
+// Four positions at a time. The byte counts are summed into 64-bit lanes with a sum of absolute differences.
+std::uint64_t count_leaves_avx2(const Bitboard* movers, const Bitboard* others, const Bitboard* en_passant, std::size_t size)
+{
+    const __m256i back_ranks = _mm256_set1_epi64x(static_cast<long long>(MOVER_BACK_RANKS));
+    const __m256i rank_3 = _mm256_set1_epi64x(static_cast<long long>(MOVER_RANK_3));
+    const __m256i not_file_a = _mm256_set1_epi64x(static_cast<long long>(~FILE_A));
+    const __m256i not_file_h = _mm256_set1_epi64x(static_cast<long long>(~FILE_H));
+
+    __m256i sums = _mm256_setzero_si256();
+    std::size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        __m256i mover = _mm256_load_si256(reinterpret_cast<const __m256i*>(movers + i));
+        __m256i other = _mm256_load_si256(reinterpret_cast<const __m256i*>(others + i));
+        __m256i ep = _mm256_load_si256(reinterpret_cast<const __m256i*>(en_passant + i));
+        __m256i pawns = _mm256_andnot_si256(back_ranks, mover);
+        __m256i empty = _mm256_xor_si256(_mm256_or_si256(mover, other), _mm256_set1_epi64x(-1));
+        __m256i targets = _mm256_or_si256(other, ep);
+        __m256i single_advances = _mm256_and_si256(_mm256_srli_epi64(pawns, 8), empty);
+        __m256i double_advances = _mm256_and_si256(_mm256_srli_epi64(_mm256_and_si256(single_advances, rank_3), 8), empty);
+        __m256i left_captures = _mm256_and_si256(_mm256_srli_epi64(_mm256_and_si256(pawns, not_file_a), 7), targets);
+        __m256i right_captures = _mm256_and_si256(_mm256_srli_epi64(_mm256_and_si256(pawns, not_file_h), 9), targets);
+        // Each byte's count is at most 8, so four of them added together still fit in a byte
+        __m256i counts = _mm256_add_epi8(_mm256_add_epi8(byte_popcounts(single_advances), byte_popcounts(double_advances)),
+                                         _mm256_add_epi8(byte_popcounts(left_captures), byte_popcounts(right_captures)));
+        sums = _mm256_add_epi64(sums, _mm256_sad_epu8(counts, _mm256_setzero_si256()));
+    }
+    alignas(32) std::uint64_t lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), sums);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + count_leaves_scalar(movers + i, others + i, en_passant + i, size - i);
+}
+
+
+// GCC 12's AVX-512 headers set off its own uninitialized-variable warnings
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+// Eight positions at a time, with a 64-bit popcount in every lane
+std::uint64_t count_leaves_avx512(const Bitboard* movers, const Bitboard* others, const Bitboard* en_passant, std::size_t size)
+{
+    const __m512i back_ranks = _mm512_set1_epi64(static_cast<long long>(MOVER_BACK_RANKS));
+    const __m512i rank_3 = _mm512_set1_epi64(static_cast<long long>(MOVER_RANK_3));
+    const __m512i not_file_a = _mm512_set1_epi64(static_cast<long long>(~FILE_A));
+    const __m512i not_file_h = _mm512_set1_epi64(static_cast<long long>(~FILE_H));
+
+    __m512i sums = _mm512_setzero_si512();
+    std::size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        __m512i mover = _mm512_load_si512(movers + i);
+        __m512i other = _mm512_load_si512(others + i);
+        __m512i ep = _mm512_load_si512(en_passant + i);
+        __m512i pawns = _mm512_andnot_si512(back_ranks, mover);
+        __m512i empty = _mm512_ternarylogic_epi64(mover, other, other, 0x03);     // ~(mover | other)
+        __m512i targets = _mm512_or_si512(other, ep);
+        __m512i single_advances = _mm512_and_si512(_mm512_srli_epi64(pawns, 8), empty);
+        __m512i double_advances = _mm512_and_si512(_mm512_srli_epi64(_mm512_and_si512(single_advances, rank_3), 8), empty);
+        __m512i left_captures = _mm512_and_si512(_mm512_srli_epi64(_mm512_and_si512(pawns, not_file_a), 7), targets);
+        __m512i right_captures = _mm512_and_si512(_mm512_srli_epi64(_mm512_and_si512(pawns, not_file_h), 9), targets);
+        sums = _mm512_add_epi64(sums, _mm512_add_epi64(_mm512_add_epi64(_mm512_popcnt_epi64(single_advances),
+                                                                        _mm512_popcnt_epi64(double_advances)),
+                                                       _mm512_add_epi64(_mm512_popcnt_epi64(left_captures),
+                                                                        _mm512_popcnt_epi64(right_captures))));
+    }
+    return _mm512_reduce_add_epi64(sums) + count_leaves_scalar(movers + i, others + i, en_passant + i, size - i);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif
+
+
+LeafKernel choose_kernel(const char*& name)
+{
+#if defined(PEASANT_X86_SIMD) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq")) {
+        name = "avx512";
+        return count_leaves_avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        name = "avx2";
+        return count_leaves_avx2;
+    }
+#elif defined(PEASANT_X86_SIMD) && defined(_MSC_VER)
+    // MSVC has no __builtin_cpu_supports, so ask CPUID. The OS also has to save the wider registers
+    // on a context switch, which XGETBV says: YMM state for AVX2, and opmask and ZMM state as well for AVX-512.
+    int info[4];
+    __cpuid(info, 0);
+    int max_leaf = info[0];
+    __cpuid(info, 1);
+    bool has_xsave = (info[2] & (1 << 27)) != 0;           // OSXSAVE
+    unsigned long long xcr0 = has_xsave ? _xgetbv(0) : 0;
+    bool os_saves_ymm = (xcr0 & 0x06) == 0x06;
+    bool os_saves_zmm = (xcr0 & 0xe6) == 0xe6;
+    if (max_leaf >= 7) {
+        __cpuidex(info, 7, 0);
+        bool has_avx2 = (info[1] & (1 << 5)) != 0;
+        bool has_avx512f = (info[1] & (1 << 16)) != 0;
+        bool has_vpopcntdq = (info[2] & (1 << 14)) != 0;
+        if (os_saves_zmm && has_avx512f && has_vpopcntdq) {
+            name = "avx512";
+            return count_leaves_avx512;
+        }
+        if (os_saves_ymm && has_avx2) {
+            name = "avx2";
+            return count_leaves_avx2;
+        }
+    }
+#endif
+    name = "scalar";
+    return count_leaves_scalar;
+}
+
+} // anon namespace
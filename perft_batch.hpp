@@ -0,0 +1,56 @@
+#ifndef PEASANT_PERFT_BATCH_HPP
+#define PEASANT_PERFT_BATCH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include "position.hpp"
+#include "tt.hpp"
+
+// Perft that counts the last ply in batches. perft_node counts the moves of each position one ply above
+// the leaves as it reaches it; this gathers those positions, across however many subtrees it takes,
+// into structure-of-arrays batches and counts a whole batch at once with a SIMD kernel
+// (AVX-512 or AVX2, whichever the CPU has, with a scalar fallback).
+// The counts are the same as perft_node's.
+std::uint64_t batched_perft_node(int depth, const Position& pos, PerftTable& table);
+
+// Which kernel batched_perft_node counts with on this CPU: "avx512", "avx2" or "scalar"
+const char* leaf_kernel_name();
+
+// The positions one ply above the leaves, waiting to have their moves counted.
+// They're kept as they are straight after the move that reached them, before flip_board,
+// so it's their_pawns that are to move, down the board.
+class LeafBatch
+{
+public:
+    static const std::size_t CAPACITY = 256;
+
+    LeafBatch();
+    void add(const Position& moved_pos)
+    {
+        m_movers[m_size] = moved_pos.their_pawns;
+        // The en passant marker is on my_pawns' first rank, two ranks behind the square it stands for
+        m_others[m_size] = moved_pos.my_pawns & ~RANK_1;
+        m_en_passant[m_size] = (moved_pos.my_pawns & RANK_1) << 16;
+        if (++m_size == CAPACITY) {
+            flush();
+        }
+    }
+    void add_leaves(std::uint64_t num_leaves) { m_total += num_leaves; }
+    // Everything added so far
+    std::uint64_t total()
+    {
+        flush();
+        return m_total;
+    }
+
+private:
+    void flush();
+
+    alignas(64) Bitboard m_movers[CAPACITY];
+    alignas(64) Bitboard m_others[CAPACITY];
+    alignas(64) Bitboard m_en_passant[CAPACITY];
+    std::size_t m_size;
+    std::uint64_t m_total;
+};
+
+#endif
@@ -1,28 +1,63 @@
 #ifndef PEASANT_POSITION_HPP
 #define PEASANT_POSITION_HPP
 
+#include <cstdint>
 #include <optional>
+#include <type_traits>
 #include "bitboards.hpp"
 
+// Their pawns can never stand on my rank 8, which is their own first rank, so that rank of their_pawns
+// holds the en passant square instead: bit 56+f is set when the en passant square is 40+f (f = 0 is the h file).
+// That keeps a position down to two bitboards, and flipping, mirroring, comparing and hashing them as a whole
+// carry the en passant square along for free. Anything that wants their actual pawns has to mask it off.
+// This needs both sides' first ranks to be empty of their own pawns, not just theirs: after flip_board,
+// my rank 1 is their rank 8, and the children of a move carry the opponent's marker there (see SearchMove).
+// No move can put a pawn back on its own first rank, so parse_fen checks it once for both sides.
 struct Position
 {
     Bitboard my_pawns;
     Bitboard their_pawns;
-    std::optional<unsigned int> en_passant_bitnum;
+
+    bool has_en_passant() const { return their_pawns & RANK_8; }
+
+    // Only call if has_en_passant()
+    unsigned int en_passant_bitnum() const { return lowest_bitnum(their_pawns & RANK_8) - 16; }
+
+    // The en passant square as a bitboard, or 0 if there isn't one
+    Bitboard en_passant_bit() const { return (their_pawns & RANK_8) >> 16; }
+
+    Bitboard their_pawns_only() const { return their_pawns & ~RANK_8; }
 
     bool operator==(const Position& rhs) const {
-        return my_pawns == rhs.my_pawns &&
-               their_pawns == rhs.their_pawns &&
-               en_passant_bitnum == rhs.en_passant_bitnum;
+        return my_pawns == rhs.my_pawns && their_pawns == rhs.their_pawns;
     }
 
     bool operator!=(const Position& rhs) const { return !(*this == rhs); }
 };
 
+static_assert(sizeof(Position) == 16 && std::is_trivially_copyable_v<Position>);
+
+inline Position make_position(Bitboard my_pawns, Bitboard their_pawns, std::optional<unsigned int> en_passant_bitnum)
+{
+    Bitboard marker = en_passant_bitnum ? 1ULL << (*en_passant_bitnum + 16) : 0;
+    return {my_pawns, their_pawns | marker};
+}
+
 struct Move
 {
-    unsigned int src_bitnum;
-    unsigned int dest_bitnum;
+    std::uint8_t src_bitnum;
+    std::uint8_t dest_bitnum;
+
+    bool operator==(const Move& rhs) const {
+        return src_bitnum == rhs.src_bitnum && dest_bitnum == rhs.dest_bitnum;
+    }
+
+    bool operator!=(const Move& rhs) const { return !(*this == rhs); }
 };
 
+inline Move to_move(unsigned int src_bitnum, unsigned int dest_bitnum)
+{
+    return {static_cast<std::uint8_t>(src_bitnum), static_cast<std::uint8_t>(dest_bitnum)};
+}
+
 #endif
@@ -0,0 +1,358 @@
+#include <algorithm>
+#include <vector>
+#include "analysis.hpp"
+#include "hash.hpp"
+#include "movegen.hpp"
+#include "proof.hpp"
+
+namespace
+{
+const std::uint32_t INFINITE = ProofTable::INFINITE;
+
+struct ProofNumbers
+{
+    std::uint32_t proof;
+    std::uint32_t disproof;
+};
+
+struct DfpnState
+{
+    SearchContext& context;
+    ProofTable& table;
+    std::uint64_t num_nodes;
+};
+
+// One position in the tree pns keeps in memory.
+// Children are stored together, so a node only needs the index of its first one.
+struct PnsNode
+{
+    Position pos;
+    PositionHash hash;
+    Move move;                                  // the move that led here
+    ProofNumbers numbers;
+    std::size_t parent;
+    std::size_t first_child;
+    int num_children;
+    int threshold;
+    bool is_expanded;
+};
+
+bool find_known_answer(const Position& pos, const PositionHash& hash, int threshold, SearchContext& context, bool& answer);
+ProofNumbers leaf_numbers(const Position& pos, const PositionHash& hash, int threshold, SearchContext& context);
+void store_answer(const PositionHash& hash, int threshold, bool answer, SearchContext& context);
+template<typename Iterator> ProofNumbers combine_children(Iterator begin, Iterator end);
+std::uint64_t make_proof_key(const PositionHash& hash, int threshold);
+ProofNumbers lookup_dfpn(DfpnState& state, const Position& pos, const PositionHash& hash, int threshold);
+ProofNumbers mid(DfpnState& state,
+                 const Position& pos,
+                 const PositionHash& hash,
+                 int threshold,
+                 std::uint32_t proof_threshold,
+                 std::uint32_t disproof_threshold);
+void find_dfpn_line(DfpnState& state, Position pos, PositionHash hash, int threshold, bool answer, Variation& line);
+ProofResult get_result(const ProofNumbers& numbers);
+}
+
+
+// Proof-number search: keeps the whole tree in memory and always expands the most-proving node.
+// Gives up once the tree would grow past max_nodes.
+// Answers it finds are stored in the context's TT as bounds, so alpha-beta and later proofs can use them.
+ProofSearchResult pns_prove(const Position& pos, int threshold, SearchContext& context, std::size_t max_nodes)
+{
+    std::vector<PnsNode> nodes;
+    PositionHash root_hash = calc_position_hash(pos);
+    nodes.push_back({pos, root_hash, {0, 0}, leaf_numbers(pos, root_hash, threshold, context), 0, 0, 0, threshold, false});
+
+    while (get_result(nodes[0].numbers) == ProofResult::UNKNOWN) {
+        // Find the most-proving node: at each step down, the child whose disproof number is our proof number
+        std::size_t index = 0;
+        while (nodes[index].is_expanded) {
+            const PnsNode& node = nodes[index];
+            std::size_t best = node.first_child;
+            for (std::size_t i = node.first_child; i < node.first_child + node.num_children; ++i) {
+                if (nodes[i].numbers.disproof < nodes[best].numbers.disproof) {
+                    best = i;
+                }
+            }
+            index = best;
+        }
+
+        if (nodes.size() + MAX_BRANCHES > max_nodes) {
+            return {ProofResult::UNKNOWN, nodes.size(), {}};
+        }
+
+        MoveList movelist;
+        gen_moves(movelist, nodes[index].pos);
+        nodes[index].first_child = nodes.size();
+        nodes[index].num_children = static_cast<int>(movelist.size());
+        nodes[index].is_expanded = true;
+        int child_threshold = 1 - nodes[index].threshold;
+        for (const SearchMove& move : movelist) {
+            const PnsNode& parent = nodes[index];
+            Position child_pos = flip_board(move.new_pos);
+            PositionHash child_hash = update_position_hash(parent.hash, parent.pos, move.new_pos).flipped();
+            ProofNumbers numbers = leaf_numbers(child_pos, child_hash, child_threshold, context);
+            nodes.push_back({child_pos, child_hash, move.move, numbers, index, 0, 0, child_threshold, false});
+        }
+
+        // Back the new numbers up toward the root until they stop changing
+        for (;;) {
+            PnsNode& node = nodes[index];
+            auto first_child = nodes.begin() + node.first_child;
+            ProofNumbers numbers = combine_children(first_child, first_child + node.num_children);
+            bool changed = numbers.proof != node.numbers.proof || numbers.disproof != node.numbers.disproof;
+            node.numbers = numbers;
+            if (get_result(numbers) != ProofResult::UNKNOWN) {
+                store_answer(node.hash, node.threshold, numbers.proof == 0, context);
+            }
+            if (index == 0 || !changed) {
+                break;
+            }
+            index = node.parent;
+        }
+    }
+
+    // Follow the proof down: where the answer is yes, the move that proves it;
+    // where it's no, any move, since they all fail
+    ProofSearchResult result = {get_result(nodes[0].numbers), nodes.size(), {}};
+    std::size_t index = 0;
+    while (nodes[index].is_expanded && result.line.size() < MAX_DEPTH) {
+        const PnsNode& node = nodes[index];
+        bool answer = node.numbers.proof == 0;
+        std::size_t next = node.first_child;
+        for (std::size_t i = node.first_child; i < node.first_child + node.num_children; ++i) {
+            if ((answer && nodes[i].numbers.disproof == 0) || (!answer && nodes[i].numbers.proof == 0)) {
+                next = i;
+                break;
+            }
+        }
+        result.line.push_back(nodes[next].move);
+        index = next;
+    }
+    return result;
+}
+
+
+// Depth-first proof-number search. It explores in the same order as pns, but keeps only the current path
+// in memory; everything else lives in the proof table, which has a fixed size.
+ProofSearchResult dfpn_prove(const Position& pos, int threshold, SearchContext& context, ProofTable& table)
+{
+    DfpnState state = {context, table, 0};
+    PositionHash hash = calc_position_hash(pos);
+    ProofNumbers numbers = lookup_dfpn(state, pos, hash, threshold);
+    if (get_result(numbers) == ProofResult::UNKNOWN) {
+        numbers = mid(state, pos, hash, threshold, INFINITE, INFINITE);
+    }
+
+    ProofSearchResult result = {get_result(numbers), state.num_nodes, {}};
+    find_dfpn_line(state, pos, hash, threshold, numbers.proof == 0, result.line);
+    return result;
+}
+
+
+namespace
+{
+
+// Returns true if the answer can be had without searching: the game is over, or the tablebase or TT knows
+bool find_known_answer(const Position& pos, const PositionHash& hash, int threshold, SearchContext& context, bool& answer)
+{
+    if (!pos.my_pawns || pos.their_pawns & RANK_1) {
+        answer = -1 >= threshold;
+        return true;
+    }
+
+    int score;
+    if (context.tablebase && context.tablebase->probe(pos, score)) {
+        answer = score >= threshold;
+        return true;
+    }
+
+    TTEntry entry;
+    if (context.tt.fetch(hash.canonical(), entry)) {
+        if (entry.lower_bound >= threshold) {
+            answer = true;
+            return true;
+        }
+        if (entry.upper_bound < threshold) {
+            answer = false;
+            return true;
+        }
+    }
+
+    StaticBounds static_bounds = analyze_position(pos);
+    if (static_bounds.lower_bound >= threshold) {
+        answer = true;
+        return true;
+    }
+    if (static_bounds.upper_bound < threshold) {
+        answer = false;
+        return true;
+    }
+
+    return false;
+}
+
+// The numbers for a node that hasn't been searched
+ProofNumbers leaf_numbers(const Position& pos, const PositionHash& hash, int threshold, SearchContext& context)
+{
+    bool answer;
+    if (find_known_answer(pos, hash, threshold, context, answer)) {
+        return answer ? ProofNumbers{0, INFINITE} : ProofNumbers{INFINITE, 0};
+    }
+    return {1, 1};
+}
+
+// Records the answer in the TT as a bound, keeping anything the TT already knew
+void store_answer(const PositionHash& hash, int threshold, bool answer, SearchContext& context)
+{
+    int lower_bound = -1;
+    int upper_bound = 1;
+    int depth = 0;
+    TTEntry entry;
+    if (context.tt.fetch(hash.canonical(), entry)) {
+        lower_bound = entry.lower_bound;
+        upper_bound = entry.upper_bound;
+        depth = entry.depth;
+    }
+    if (answer) {
+        lower_bound = std::max(lower_bound, threshold);
+    } else {
+        upper_bound = std::min(upper_bound, threshold - 1);
+    }
+    context.tt.insert(hash.canonical(), TTEntry(lower_bound, upper_bound, depth));
+}
+
+// Children answer the opposite question for the other side, so my proof number is the smallest
+// of their disproof numbers, and my disproof number is the sum of their proof numbers
+template<typename Iterator>
+ProofNumbers combine_children(Iterator begin, Iterator end)
+{
+    ProofNumbers numbers = {INFINITE, 0};
+    for (Iterator child = begin; child != end; ++child) {
+        numbers.proof = std::min(numbers.proof, child->numbers.disproof);
+        numbers.disproof = std::min(INFINITE, numbers.disproof + child->numbers.proof);
+    }
+    return numbers;
+}
+
+
+std::uint64_t make_proof_key(const PositionHash& hash, int threshold)
+{
+    return hash.canonical() ^ ((threshold + 2) * 0x9e37'79b9'7f4a'7c15ULL);
+}
+
+ProofNumbers lookup_dfpn(DfpnState& state, const Position& pos, const PositionHash& hash, int threshold)
+{
+    ProofNumbers numbers;
+    if (state.table.fetch(make_proof_key(hash, threshold), numbers.proof, numbers.disproof)) {
+        return numbers;
+    }
+    return leaf_numbers(pos, hash, threshold, state.context);
+}
+
+// Searches until the node's proof number reaches proof_threshold or its disproof number reaches disproof_threshold.
+// The position must not be one whose answer is already known.
+ProofNumbers mid(DfpnState& state,
+                 const Position& pos,
+                 const PositionHash& hash,
+                 int threshold,
+                 std::uint32_t proof_threshold,
+                 std::uint32_t disproof_threshold)
+{
+    ++state.num_nodes;
+    std::uint64_t nodes_before = state.num_nodes;
+
+    struct Child
+    {
+        Position pos;
+        PositionHash hash;
+        ProofNumbers numbers;
+    };
+    boost::container::static_vector<Child, MAX_BRANCHES> children;
+    int child_threshold = 1 - threshold;
+    MoveList movelist;
+    gen_moves(movelist, pos);
+    for (const SearchMove& move : movelist) {
+        Position child_pos = flip_board(move.new_pos);
+        PositionHash child_hash = update_position_hash(hash, pos, move.new_pos).flipped();
+        children.push_back({child_pos, child_hash, lookup_dfpn(state, child_pos, child_hash, child_threshold)});
+    }
+
+    ProofNumbers numbers;
+    for (;;) {
+        numbers = combine_children(children.begin(), children.end());
+        if (numbers.proof >= proof_threshold || numbers.disproof >= disproof_threshold) {
+            break;
+        }
+
+        // The most-proving child has the smallest disproof number.
+        // It's searched until it's no longer the best, or until the thresholds would stop us anyway.
+        std::size_t best = 0;
+        std::uint32_t second_best_disproof = INFINITE;
+        for (std::size_t i = 1; i < children.size(); ++i) {
+            if (children[i].numbers.disproof < children[best].numbers.disproof) {
+                second_best_disproof = children[best].numbers.disproof;
+                best = i;
+            } else {
+                second_best_disproof = std::min(second_best_disproof, children[i].numbers.disproof);
+            }
+        }
+        Child& child = children[best];
+        std::uint32_t child_proof_threshold = std::min(INFINITE,
+                                                       disproof_threshold - numbers.disproof + child.numbers.proof);
+        std::uint32_t child_disproof_threshold = std::min(proof_threshold,
+                                                          std::min(INFINITE - 1, second_best_disproof) + 1);
+        child.numbers = mid(state, child.pos, child.hash, child_threshold, child_proof_threshold, child_disproof_threshold);
+    }
+
+    if (get_result(numbers) != ProofResult::UNKNOWN) {
+        store_answer(hash, threshold, numbers.proof == 0, state.context);
+    }
+    state.table.insert(make_proof_key(hash, threshold), numbers.proof, numbers.disproof, state.num_nodes - nodes_before + 1);
+    return numbers;
+}
+
+// Like the line pns gives, but pieced together from the tables, so it stops early if an entry has been replaced
+void find_dfpn_line(DfpnState& state, Position pos, PositionHash hash, int threshold, bool answer, Variation& line)
+{
+    while (line.size() < MAX_DEPTH) {
+        if (!pos.my_pawns || pos.their_pawns & RANK_1) {
+            // The game is over
+            return;
+        }
+
+        MoveList movelist;
+        gen_moves(movelist, pos);
+        bool found = false;
+        for (const SearchMove& move : movelist) {
+            Position child_pos = flip_board(move.new_pos);
+            PositionHash child_hash = update_position_hash(hash, pos, move.new_pos).flipped();
+            ProofNumbers numbers = lookup_dfpn(state, child_pos, child_hash, 1 - threshold);
+            if ((answer && numbers.disproof == 0) || (!answer && numbers.proof == 0)) {
+                line.push_back(move.move);
+                pos = child_pos;
+                hash = child_hash;
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            return;
+        }
+        threshold = 1 - threshold;
+        answer = !answer;
+    }
+}
+
+ProofResult get_result(const ProofNumbers& numbers)
+{
+    if (numbers.proof == 0) {
+        return ProofResult::PROVEN;
+    }
+    if (numbers.disproof == 0) {
+        return ProofResult::DISPROVEN;
+    }
+    return ProofResult::UNKNOWN;
+}
+
+} // anon namespace
@@ -0,0 +1,29 @@
+#ifndef PEASANT_PROOF_HPP
+#define PEASANT_PROOF_HPP
+
+#include <cstdint>
+#include "position.hpp"
+#include "search.hpp"
+#include "tt.hpp"
+
+// Proof-number search answers yes-or-no questions; here, the question is always
+// whether the side to move can get a score of at least some threshold.
+// Asking with a threshold of 1 tells wins from the rest, and a threshold of 0 tells losses from the rest.
+enum class ProofResult
+{
+    PROVEN,
+    DISPROVEN,
+    UNKNOWN                                     // ran out of room before finding out
+};
+
+struct ProofSearchResult
+{
+    ProofResult result;
+    std::uint64_t num_nodes;                    // nodes expanded (for pns, the size of the proof tree)
+    Variation line;                             // the moves that prove or disprove it, as far as they're known
+};
+
+ProofSearchResult pns_prove(const Position& pos, int threshold, SearchContext& context, std::size_t max_nodes);
+ProofSearchResult dfpn_prove(const Position& pos, int threshold, SearchContext& context, ProofTable& table);
+
+#endif
@@ -1,123 +1,70 @@
 #include <algorithm>
+#include <cassert>
+#include <sstream>
+#include <stdexcept>
+#include "analysis.hpp"
+#include "movegen.hpp"
 #include "search.hpp"
 
-// The maximum number of moves that can be made in a turn (an overestimate)
-const int MAX_BRANCHES = 64;
-
-
-struct SearchMove
-{
-    Position new_pos;
-    Move move;
-    bool is_capture;
-};
-
-typedef boost::container::static_vector<SearchMove, MAX_BRANCHES> MoveList;
-
-
 namespace
 {
-void gen_moves(MoveList& movelist, const Position& pos);
-bool try_advance(MoveList& movelist, const Position& pos, unsigned int bitnum, unsigned int num_squares, unsigned int en_passant_bitnum);
-void try_capture(MoveList& movelist, const Position& pos, unsigned int bitnum, int direction, Bitboard en_passant_bit);
-void sort_moves(MoveList& movelist);
-Position flip_board(const Position& pos);
+template<bool WITH_STATS, bool WITH_TT> SearchResult search_node_impl(int depth,
+                                                                      const Position& pos,
+                                                                      const PositionHash& hash,
+                                                                      int alpha,
+                                                                      int beta,
+                                                                      SearchContext& context);
+template<bool WITH_TABLE, bool HAS_EN_PASSANT> std::uint64_t perft_node_impl(int depth,
+                                                                             const Position& pos,
+                                                                             PerftTable& table);
+void remove_mirrored_moves(MoveList& movelist);
 SearchResult negate_search_result(SearchResult result);
 }
 
 
-// pv is strictly an output that will hold the principal variation of this subtree.
-// It should be empty, and will remain empty if this is a leaf node
-// Returned bounds are clamped at (alpha, beta)
-// @XXX@ no pv stored in TT
-SearchResult search_node(int depth, const Position& pos, int alpha, int beta, TranspositionTable& tt, Variation& pv)
+// The principal variation of this subtree is left in the context's PV table, at the context's ply.
+// It will be empty if this is a leaf node
+// Returned bounds are fail-soft: they are true bounds on the score and may lie outside (alpha, beta)
+// If the context's stop flag gets set, the result is meaningless and should be thrown away
+// If the context has somewhere to put statistics, they're added to it; otherwise they cost nothing.
+// The same goes for a TT of size zero: the search is compiled once with the TT and once without.
+SearchResult search_node(int depth,
+                         const Position& pos,
+                         const PositionHash& hash,
+                         int alpha,
+                         int beta,
+                         SearchContext& context)
 {
-    assert(pv.size() == 0);
-
-    // Check if position is in transposition table
-    // @TODO@ -- don't want to waste time hashing if TT's size is zero
-    std::uint64_t hash = calc_hash(pos);
-
-    if (!pos.my_pawns || pos.their_pawns & 0x0000'0000'0000'00ffULL) {
-        // I have no pawns or an enemy pawn is on my first rank! I've lost!
-        TTEntry tt_entry(pos, -1, 1, -1, -1, depth);
-        tt.insert(hash, tt_entry);
-        return {std::max(-1, alpha), std::min(-1, beta), 1};
+    bool with_tt = context.tt.is_enabled();
+    if (context.stats) {
+        return with_tt ? search_node_impl<true, true>(depth, pos, hash, alpha, beta, context)
+                       : search_node_impl<true, false>(depth, pos, hash, alpha, beta, context);
     }
+    return with_tt ? search_node_impl<false, true>(depth, pos, hash, alpha, beta, context)
+                   : search_node_impl<false, false>(depth, pos, hash, alpha, beta, context);
+}
 
-    /*const TTEntry* tt_entry_ptr = tt.fetch(hash, pos);
-    if (tt_entry_ptr
-        && tt_entry_ptr->depth >= depth
-        && tt_entry_ptr->alpha <= alpha
-        && tt_entry_ptr->beta >= beta) {
-        return {std::max(tt_entry_ptr->lower_bound, alpha), std::min(tt_entry_ptr->upper_bound, beta), 1};
-    }*/
-
-    // @TODO@ -- perhaps check for positions that will clearly be stalemate (all files dead)
 
-    // @TODO@ -- perhaps check for passed pawns and don't stop searching if there are any
+// The table may have a size of zero, in which case it isn't used.
+// Whether it's used, and whether the position has an en passant square, are settled once here;
+// below that, each case has its own compiled kernel.
+std::uint64_t perft_node(int depth, const Position& pos, PerftTable& table)
+{
     if (depth == 0) {
-        // Result is unknown
-        TTEntry tt_entry(pos, -1, 1, -1, 1, depth);
-        tt.insert(hash, tt_entry);
-        return {alpha, beta, 1};
+        return 1;
     }
-
-    MoveList movelist;
-    gen_moves(movelist, pos);
-
-    if (movelist.size() == 0) {
-        // Stalemate
-        TTEntry tt_entry(pos, -1, 1, 0, 0, depth);
-        tt.insert(hash, tt_entry);
-        return {std::clamp(0, alpha, beta), std::min(0, beta), 1};
+    bool has_en_passant = pos.has_en_passant();
+    if (table.is_enabled()) {
+        return has_en_passant ? perft_node_impl<true, true>(depth, pos, table)
+                              : perft_node_impl<true, false>(depth, pos, table);
     }
-
-    sort_moves(movelist);
-
-    int best_lower_bound = -1;
-    int best_upper_bound = -1;
-    std::uint64_t num_childrens_leaves = 0;
-    int old_alpha = alpha;
-    for (const SearchMove& move : movelist) {
-        Variation subvariation;
-        SearchResult child_result = search_node(depth - 1,
-                                                flip_board(move.new_pos),
-                                                -beta,
-                                                -alpha,
-                                                tt,
-                                                subvariation);
-        num_childrens_leaves += child_result.num_leaves;
-        child_result = negate_search_result(child_result);      // our score is opposite of opponent's score
-        best_lower_bound = std::max(best_lower_bound, child_result.lower_bound);
-        // @TODO@ -- I want to change >= to just >, which would make it copy *much* less often.
-        // But then no move would be stored if alpha never improves.
-        // I think this would be fixable by using a starting alpha-beta window of
-        // (-inf, inf) instead of (-1, 1).
-        if (child_result.lower_bound >= alpha) {
-            alpha = child_result.lower_bound;
-            pv.resize(1);
-            pv[0] = move.move;
-            pv.insert(pv.end(), subvariation.begin(), subvariation.end());
-        }
-        if (alpha >= beta) {
-            // If we don't examine all children, we can't measure the upper bound
-            // So we use 1 instead
-            best_upper_bound = 1;
-            break;
-        }
-        best_upper_bound = std::max(best_upper_bound, child_result.upper_bound);
-    }
-
-    TTEntry tt_entry(pos, old_alpha, beta, best_lower_bound, best_upper_bound, depth);
-    tt.insert(hash, tt_entry);
-    return {std::clamp(best_lower_bound, alpha, beta),
-            std::min(best_upper_bound, beta),
-            num_childrens_leaves};
+    return has_en_passant ? perft_node_impl<false, true>(depth, pos, table)
+                          : perft_node_impl<false, false>(depth, pos, table);
 }
 
-
-std::uint64_t perft_node(int depth, const Position& pos)
+// Like perft_node, but checks gen_moves against gen_moves_reference at every node.
+// Throws if they ever disagree.
+std::uint64_t compare_perft_node(int depth, const Position& pos)
 {
     if (depth == 0) {
         return 1;
@@ -126,15 +73,24 @@ std::uint64_t perft_node(int depth, const Position& pos)
     MoveList movelist;
     gen_moves(movelist, pos);
 
+    MoveList reference_movelist;
+    gen_moves_reference(reference_movelist, pos);
+    if (!same_moves(movelist, reference_movelist)) {
+        std::ostringstream message;
+        message << std::hex << "Move generators disagree on position "
+                << pos.my_pawns << " " << pos.their_pawns;
+        throw std::runtime_error(message.str().c_str());
+    }
+
     std::uint64_t leaves = 0;
     for (const SearchMove& move : movelist) {
-        leaves += perft_node(depth - 1, flip_board(move.new_pos));
+        leaves += compare_perft_node(depth - 1, flip_board(move.new_pos));
     }
 
     return leaves;
 }
 
-std::vector<PerftMove> split_perft_node(int depth, const Position& pos)
+std::vector<PerftMove> split_perft_node(int depth, const Position& pos, PerftTable& table, PerftKernel kernel)
 {
     std::vector<PerftMove> result;
 
@@ -146,7 +102,7 @@ std::vector<PerftMove> split_perft_node(int depth, const Position& pos)
     gen_moves(movelist, pos);
 
     for (const SearchMove& move : movelist) {
-        std::uint64_t num_leaves = perft_node(depth - 1, flip_board(move.new_pos));
+        std::uint64_t num_leaves = kernel(depth - 1, flip_board(move.new_pos), table);
         PerftMove perft_move = {move.move, num_leaves};
         result.push_back(perft_move);
     }
@@ -158,102 +114,214 @@ std::vector<PerftMove> split_perft_node(int depth, const Position& pos)
 namespace
 {
 
-// This function only generates moves in the order they're found; no ordering is done.
-void gen_moves(MoveList& movelist, const Position& pos)
+template<bool WITH_STATS, bool WITH_TT>
+SearchResult search_node_impl(int depth,
+                              const Position& pos,
+                              const PositionHash& hash,
+                              int alpha,
+                              int beta,
+                              SearchContext& context)
 {
-    for (unsigned int bitnum = 8; bitnum < 56; ++bitnum) {
-        Bitboard bit = 1ULL << bitnum;
-        if (pos.my_pawns & bit) {
-            // We've found one of my pawns.
-            // Try a one-square advance
-            bool can_advance = try_advance(movelist, pos, bitnum, 1, {});
-
-            // If successful, try a two-square advance if on second rank
-            if (can_advance && bitnum < 16) {
-                try_advance(movelist, pos, bitnum, 2, bitnum+8);
-            }
+    context.pv_table.clear(context.ply);
+    // The hashes are kept up to date as moves are made; debug builds check them against the slow way
+    assert(hash == calc_position_hash(pos));
 
-            Bitboard en_passant_bit = pos.en_passant_bitnum ? 1ULL << pos.en_passant_bitnum.value() : 0;
-            unsigned int column = bitnum % 8;       // 0 = rightmost column; 7 = leftmost
-            // Don't test invalid captures (leftward capture on leftmost column, etc.)
-            if (column != 7) {
-                try_capture(movelist, pos, bitnum, -1, en_passant_bit);
+    if (context.is_stopped()) {
+        return {-1, 1, 0};
+    }
+
+    if (!pos.my_pawns || pos.their_pawns & 0x0000'0000'0000'00ffULL) {
+        // I have no pawns or an enemy pawn is on my first rank! I've lost!
+        // (This is cheaper to see than to look up, so it isn't stored in the TT)
+        return {-1, -1, 1};
+    }
+
+    int tablebase_score;
+    if (context.tablebase && context.tablebase->probe(pos, tablebase_score)) {
+        return {tablebase_score, tablebase_score, 1};
+    }
+
+    // Dead positions and won pawn races are cheaper to see than to look up, so they aren't stored either
+    StaticBounds static_bounds = analyze_position(pos);
+    if (static_bounds.lower_bound == static_bounds.upper_bound ||
+        static_bounds.lower_bound >= beta ||
+        static_bounds.upper_bound <= alpha) {
+        return {static_bounds.lower_bound, static_bounds.upper_bound, 1};
+    }
+    alpha = std::max(alpha, static_bounds.lower_bound);
+    beta = std::min(beta, static_bounds.upper_bound);
+
+    // Check if position is in transposition table (a position and its mirror share an entry)
+    TranspositionTable& tt = context.tt;
+    TTEntry tt_entry;
+    bool tt_hit = false;
+    if constexpr (WITH_TT) {
+        tt_hit = tt.fetch(hash.canonical(), tt_entry);
+    }
+    if constexpr (WITH_STATS && WITH_TT) {
+        ++context.stats->tt_probes;
+        if (tt_hit) {
+            ++context.stats->tt_hits;
+        } else if (tt.is_bucket_full(hash.canonical())) {
+            ++context.stats->tt_collisions;
+        }
+    }
+    if (tt_hit) {
+        if (tt_entry.depth >= depth || tt_entry.lower_bound >= beta || tt_entry.upper_bound <= alpha) {
+            // Either searching again wouldn't tell us any more, or what we know is enough to cut off
+            if constexpr (WITH_STATS) {
+                ++context.stats->tt_cutoffs;
             }
-            if (column != 0) {
-                try_capture(movelist, pos, bitnum, 1, en_passant_bit);
+            return {tt_entry.lower_bound, tt_entry.upper_bound, 1};
+        }
+        // The scores outside the known bounds are impossible, so don't bother searching for them
+        alpha = std::max(alpha, tt_entry.lower_bound);
+        beta = std::min(beta, tt_entry.upper_bound);
+    }
+
+    // The TT's best move is for the canonical position, which may be this one's mirror
+    bool is_mirrored = hash.canonical() != hash.hash;
+    std::optional<Move> tt_move;
+    if (tt_hit && tt_entry.best_move) {
+        tt_move = is_mirrored ? mirror_move(*tt_entry.best_move) : *tt_entry.best_move;
+    }
+
+    if (depth == 0) {
+        // Result is unknown, apart from what the static analysis saw
+        // (not stored in the TT, since an entry saying so is useless)
+        return {static_bounds.lower_bound, static_bounds.upper_bound, 1};
+    }
+
+    MoveList movelist;
+    gen_moves(movelist, pos);
+
+    if (movelist.size() == 0) {
+        // Stalemate
+        if constexpr (WITH_TT) {
+            tt.insert(hash.canonical(), TTEntry(0, 0, depth));
+        }
+        return {0, 0, 1};
+    }
+
+    if constexpr (WITH_STATS) {
+        ++context.stats->interior_nodes[context.ply];
+    }
+
+    if (is_symmetric(pos)) {
+        // Moves on the right half of the board lead to mirrors of what the moves on the left half lead to
+        remove_mirrored_moves(movelist);
+    }
+
+    int best_lower_bound = -1;
+    int best_upper_bound = -1;
+    std::uint64_t num_childrens_leaves = 0;
+    MovePicker picker(movelist, tt_move, context.history, context.ply);
+    int num_searched = 0;
+    while (const SearchMove* next_move = picker.next()) {
+        const SearchMove& move = *next_move;
+        ++context.ply;
+        SearchResult child_result = search_node_impl<WITH_STATS, WITH_TT>(depth - 1,
+                                                                          flip_board(move.new_pos),
+                                                                          update_position_hash(hash, pos, move.new_pos).flipped(),
+                                                                          -beta,
+                                                                          -alpha,
+                                                                          context);
+        --context.ply;
+        ++num_searched;
+        num_childrens_leaves += child_result.num_leaves;
+        if (context.is_stopped()) {
+            // Don't let a half-finished search into the TT
+            return {-1, 1, num_childrens_leaves};
+        }
+        child_result = negate_search_result(child_result);      // our score is opposite of opponent's score
+        // The line follows the move with the best lower bound so far. Under a null window, alpha often
+        // isn't reached at all, so the first move searched stands in until a better one comes along.
+        if (num_searched == 1 || child_result.lower_bound > best_lower_bound) {
+            context.pv_table.update(context.ply, move.move);
+        }
+        best_lower_bound = std::max(best_lower_bound, child_result.lower_bound);
+        alpha = std::max(alpha, child_result.lower_bound);
+        if (alpha >= beta) {
+            // If we don't examine all children, we can't measure the upper bound
+            // So we use 1 instead
+            best_upper_bound = 1;
+            context.history.record_cutoff(move, depth, context.ply);
+            ++context.cutoff_stats.num_cutoffs;
+            if (num_searched == 1) {
+                ++context.cutoff_stats.num_first_move_cutoffs;
             }
+            break;
         }
+        best_upper_bound = std::max(best_upper_bound, child_result.upper_bound);
     }
-}
 
-// Only checks if the destination is occupied; two-square advances do not check if a pawn is in the way!
-// (This should be done by only calling after checking the result of a one-square advance)
-// Returns true if the square was unoccupied
-bool try_advance(MoveList& movelist,
-                 const Position& pos,
-                 unsigned int bitnum,
-                 unsigned int num_squares,
-                 unsigned int new_en_passant_bitnum)
-{
-    unsigned int dest_bitnum = bitnum+8*num_squares;
-    Bitboard all_pawns = pos.my_pawns | pos.their_pawns;
-    Bitboard bit = 1ULL << bitnum;
-    Bitboard dest = 1ULL << dest_bitnum;
-    if (!(all_pawns & dest)) {
-        // The destination is empty; we can advance
-        Bitboard my_new_pawns = (pos.my_pawns | dest) & ~bit;
-        SearchMove move = {{my_new_pawns, pos.their_pawns, new_en_passant_bitnum}, {bitnum, dest_bitnum}, false};
-        movelist.push_back(move);
-        return true;
+    best_lower_bound = std::max(best_lower_bound, static_bounds.lower_bound);
+    best_upper_bound = std::min(best_upper_bound, static_bounds.upper_bound);
+    if (tt_hit) {
+        // What we knew before is still true, so keep it
+        best_lower_bound = std::max(best_lower_bound, tt_entry.lower_bound);
+        best_upper_bound = std::min(best_upper_bound, tt_entry.upper_bound);
+    }
+    std::optional<Move> best_move = tt_move;
+    if (!context.pv_table.is_empty(context.ply)) {
+        best_move = context.pv_table.first_move(context.ply);
     }
-    return false;
+    if (best_move && is_mirrored) {
+        best_move = mirror_move(*best_move);
+    }
+    if constexpr (WITH_TT) {
+        bool overwrote = tt.insert(hash.canonical(), TTEntry(best_lower_bound, best_upper_bound, depth, best_move));
+        if constexpr (WITH_STATS) {
+            context.stats->tt_overwrites += overwrote;
+        }
+    }
+    return {best_lower_bound, best_upper_bound, num_childrens_leaves};
 }
 
-void try_capture(MoveList& movelist,
-                 const Position& pos,
-                 unsigned int bitnum,
-                 int direction,                     // -1 = leftward; 1 = rightward
-                 Bitboard en_passant_bit)
+
+// depth is at least 1. The children's specializations come from visit_moves,
+// which knows which moves leave an en passant square behind.
+template<bool WITH_TABLE, bool HAS_EN_PASSANT>
+std::uint64_t perft_node_impl(int depth, const Position& pos, PerftTable& table)
 {
-    unsigned int dest_bitnum = bitnum + 8 - direction;
-    Bitboard bit = 1ULL << bitnum;
-    Bitboard dest = 1ULL << dest_bitnum;
-    assert(dest != 0);
-    if ((pos.their_pawns & dest) || dest == en_passant_bit) {
-        // Capture is possible
-        Bitboard my_new_pawns = (pos.my_pawns | dest) & ~bit;
-        Bitboard captured_pawn = (dest == en_passant_bit) ? dest >> 8 : dest;
-        Bitboard their_new_pawns = pos.their_pawns & ~captured_pawn;
-        SearchMove move = {{my_new_pawns, their_new_pawns, {}}, {bitnum, dest_bitnum}, true};
-        movelist.push_back(move);
+    if (depth == 1) {
+        // Every move is a leaf, so there's no need to make them
+        return count_moves<HAS_EN_PASSANT>(pos);
     }
-}
 
+    std::uint64_t hash = 0;
+    if constexpr (WITH_TABLE) {
+        hash = calc_canonical_hash(pos);
+        std::uint64_t num_leaves;
+        if (table.fetch(hash, depth, num_leaves)) {
+            return num_leaves;
+        }
+    }
 
-void sort_moves(MoveList& movelist)
-{
-    std::sort(movelist.begin(),
-              movelist.end(),
-              [](SearchMove a, SearchMove b) -> bool {
-                return a.is_capture && !b.is_capture;
-              });
+    std::uint64_t leaves = 0;
+    visit_moves<HAS_EN_PASSANT>(pos, [&](const SearchMove& move, auto child_has_en_passant) {
+        leaves += perft_node_impl<WITH_TABLE, decltype(child_has_en_passant)::value>(depth - 1,
+                                                                                     flip_board(move.new_pos),
+                                                                                     table);
+    });
+
+    if constexpr (WITH_TABLE) {
+        table.insert(hash, depth, leaves);
+    }
+    return leaves;
 }
 
 
-// Rotates the bitboards so that my_pawns and their_pawns are switched and vertically flipped
-// Equivalent to rotating by 180 degrees, except the board is horizontally mirrored
-// (we do this instead of the full rotation because it's faster)
-Position flip_board(const Position& pos)
+// Keeps only the moves from files a-d; each move from files e-h is the mirror of one of those
+void remove_mirrored_moves(MoveList& movelist)
 {
-    std::optional<unsigned int> en_passant;
-    if (pos.en_passant_bitnum) {
-        en_passant = pos.en_passant_bitnum.value() ^ 56;
-    }
-    return {vflip_bitboard(pos.their_pawns),
-            vflip_bitboard(pos.my_pawns),
-            en_passant};
+    auto is_mirrored = [](const SearchMove& move) -> bool {
+        return move.move.src_bitnum % 8 < 4;        // column 0 is the h file
+    };
+    movelist.erase(std::remove_if(movelist.begin(), movelist.end(), is_mirrored), movelist.end());
 }
 
+
 // Negates results for negamax
 SearchResult negate_search_result(SearchResult result)
 {
@@ -1,9 +1,14 @@
 #ifndef PEASANT_SEARCH_HPP
 #define PEASANT_SEARCH_HPP
 
+#include <algorithm>
+#include <atomic>
+#include <vector>
 #include <boost/container/static_vector.hpp>
 #include "bitboards.hpp"
+#include "move_order.hpp"
 #include "position.hpp"
+#include "tablebase.hpp"
 #include "tt.hpp"
 
 struct SearchResult {
@@ -22,8 +27,108 @@ const std::size_t MAX_DEPTH = 256;
 
 typedef boost::container::static_vector<Move, MAX_DEPTH> Variation;
 
-SearchResult search_node(int depth, const Position& pos, int alpha, int beta, TranspositionTable& tt, Variation& pv);
-std::uint64_t perft_node(int depth, const Position& pos);
-std::vector<PerftMove> split_perft_node(int depth, const Position& pos);
+
+// The principal variations of every node on the path being searched, in one triangular array:
+// the line of the node at ply p is kept in row p, which has room for MAX_DEPTH - p moves.
+// When a node finds a better move, its line becomes that move followed by the child's line from row p + 1,
+// so lines are only copied when they improve, and a search frame doesn't need a Variation of its own.
+class PVTable
+{
+public:
+    PVTable()
+      : m_moves(MAX_DEPTH * (MAX_DEPTH + 1) / 2),
+        m_lengths(MAX_DEPTH + 1)
+    {
+    }
+
+    void clear(int ply) { m_lengths[ply] = 0; }
+
+    // The line at ply becomes move followed by the line at ply + 1
+    void update(int ply, const Move& move)
+    {
+        Move* row = &m_moves[row_offset(ply)];
+        const Move* child_row = &m_moves[row_offset(ply + 1)];
+        row[0] = move;
+        std::copy(child_row, child_row + m_lengths[ply + 1], row + 1);
+        m_lengths[ply] = m_lengths[ply + 1] + 1;
+    }
+
+    bool is_empty(int ply) const { return m_lengths[ply] == 0; }
+    const Move& first_move(int ply) const { return m_moves[row_offset(ply)]; }
+
+    Variation line(int ply) const
+    {
+        const Move* row = &m_moves[row_offset(ply)];
+        return Variation(row, row + m_lengths[ply]);
+    }
+
+private:
+    static std::size_t row_offset(int ply) { return ply*MAX_DEPTH - ply*(ply - 1)/2; }
+
+    std::vector<Move> m_moves;
+    std::vector<std::size_t> m_lengths;
+};
+
+
+// Counters for --stats. The search only keeps them when its context points at some,
+// and is compiled separately for that case, so they cost nothing otherwise.
+struct SearchStats
+{
+    std::uint64_t interior_nodes[MAX_DEPTH + 1] = {};       // nodes whose moves were generated, by ply
+    std::uint64_t tt_probes = 0;
+    std::uint64_t tt_hits = 0;
+    std::uint64_t tt_cutoffs = 0;           // hits that answered the node without searching it
+    std::uint64_t tt_collisions = 0;        // misses in a bucket full of other positions
+    std::uint64_t tt_overwrites = 0;        // inserts that evicted another position
+
+    SearchStats& operator+=(const SearchStats& rhs) {
+        for (std::size_t ply = 0; ply <= MAX_DEPTH; ++ply) {
+            interior_nodes[ply] += rhs.interior_nodes[ply];
+        }
+        tt_probes += rhs.tt_probes;
+        tt_hits += rhs.tt_hits;
+        tt_cutoffs += rhs.tt_cutoffs;
+        tt_collisions += rhs.tt_collisions;
+        tt_overwrites += rhs.tt_overwrites;
+        return *this;
+    }
+
+    std::uint64_t total_interior_nodes() const {
+        std::uint64_t total = 0;
+        for (std::uint64_t nodes : interior_nodes) {
+            total += nodes;
+        }
+        return total;
+    }
+};
+
+
+// What a search thread needs besides the position it's searching
+struct SearchContext
+{
+    TranspositionTable& tt;
+    const std::atomic<bool>* stop;          // may be null; once set, the search returns as soon as it can
+    const Tablebase* tablebase;             // may be null
+    MoveHistory history = {};
+    CutoffStats cutoff_stats = {};
+    int ply = 0;                            // how far below the root the node being searched is
+    PVTable pv_table = {};
+    SearchStats* stats = nullptr;           // may be null, and usually is
+
+    bool is_stopped() const { return stop && stop->load(std::memory_order_relaxed); }
+};
+
+SearchResult search_node(int depth,
+                         const Position& pos,
+                         const PositionHash& hash,
+                         int alpha,
+                         int beta,
+                         SearchContext& context);
+std::uint64_t perft_node(int depth, const Position& pos, PerftTable& table);
+std::uint64_t compare_perft_node(int depth, const Position& pos);
+
+// perft_node, or anything else that gives the same counts
+typedef std::uint64_t (*PerftKernel)(int depth, const Position& pos, PerftTable& table);
+std::vector<PerftMove> split_perft_node(int depth, const Position& pos, PerftTable& table, PerftKernel kernel = perft_node);
 
 #endif
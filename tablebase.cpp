@@ -0,0 +1,323 @@
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include "movegen.hpp"
+#include "tablebase.hpp"
+#include "threadpool.hpp"
+
+namespace bip = boost::interprocess;
+
+namespace
+{
+// Pawns can only stand on these 48 squares (ranks 2-7) in a stored position
+const unsigned int FIRST_SQUARE = 8;
+const unsigned int NUM_SQUARES = 48;
+
+const char MAGIC[8] = {'P', 'E', 'A', 'S', 'T', 'B', '0', '1'};
+
+// Each class's positions are cut up into this many tasks per thread, so the work can be balanced
+const unsigned int TASKS_PER_THREAD = 64;
+
+struct TablebaseHeader
+{
+    char magic[8];
+    std::uint32_t num_my_pawns;
+    std::uint32_t num_their_pawns;
+    std::uint64_t num_positions;
+    std::uint64_t is_complete;
+};
+
+// The scores start on their own cache line
+const std::size_t DATA_OFFSET = 64;
+
+std::uint64_t binomial(unsigned int n, unsigned int k);
+std::uint64_t rank_squares(Bitboard squares);
+Bitboard unrank_squares(std::uint64_t rank, int num_squares);
+Bitboard compress_squares(Bitboard squares, Bitboard removed);
+Bitboard expand_squares(Bitboard squares, Bitboard removed);
+std::string class_filename(const std::string& directory, int num_my_pawns, int num_their_pawns);
+}
+
+
+struct Tablebase::ClassTable
+{
+    bip::file_mapping file;
+    bip::mapped_region region;
+    TablebaseHeader* header;
+    std::atomic<std::uint64_t>* words;          // 32 scores to a word
+
+    int get(std::uint64_t index) const
+    {
+        return (words[index/32].load(std::memory_order_relaxed) >> (index%32*2)) & 3;
+    }
+
+    // Every thread that solves a position gets the same score, so ORing it in is always safe
+    void set(std::uint64_t index, int code)
+    {
+        words[index/32].fetch_or(std::uint64_t(code) << (index%32*2), std::memory_order_relaxed);
+    }
+};
+
+
+Tablebase::Tablebase(const std::string& directory, int max_pawns, bool writable)
+  : m_max_pawns(std::clamp(max_pawns, 0, MAX_PAWNS))
+{
+    static_assert(sizeof(std::atomic<std::uint64_t>) == 8, "scores are mapped straight from the file as atomic words");
+    for (int my = 1; my <= m_max_pawns; ++my) {
+        for (int their = 1; their <= m_max_pawns; ++their) {
+            std::uint64_t num_positions = binomial(NUM_SQUARES, my) * binomial(NUM_SQUARES - my, their);
+            std::size_t file_size = DATA_OFFSET + (num_positions + 31)/32*8;
+            std::string filename = class_filename(directory, my, their);
+            bool exists = std::ifstream(filename).good();
+            if (!exists) {
+                if (!writable) {
+                    continue;
+                }
+                // Make a zero-filled file of the right size; all of its positions are unsolved
+                std::filebuf filebuf;
+                if (!filebuf.open(filename, std::ios::out | std::ios::binary)) {
+                    throw std::runtime_error(("Can't create tablebase file " + filename).c_str());
+                }
+                filebuf.pubseekoff(file_size - 1, std::ios::beg);
+                filebuf.sputc(0);
+            }
+
+            bip::mode_t mode = writable ? bip::read_write : bip::read_only;
+            auto table = std::make_unique<ClassTable>();
+            table->file = bip::file_mapping(filename.c_str(), mode);
+            table->region = bip::mapped_region(table->file, mode);
+            if (table->region.get_size() != file_size) {
+                throw std::runtime_error(("Tablebase file " + filename + " is the wrong size").c_str());
+            }
+            table->header = static_cast<TablebaseHeader*>(table->region.get_address());
+            table->words = reinterpret_cast<std::atomic<std::uint64_t>*>(
+                static_cast<char*>(table->region.get_address()) + DATA_OFFSET);
+            if (!exists) {
+                std::copy(std::begin(MAGIC), std::end(MAGIC), table->header->magic);
+                table->header->num_my_pawns = my;
+                table->header->num_their_pawns = their;
+                table->header->num_positions = num_positions;
+                table->header->is_complete = 0;
+            } else if (!std::equal(std::begin(MAGIC), std::end(MAGIC), table->header->magic) ||
+                       table->header->num_positions != num_positions) {
+                throw std::runtime_error(("Tablebase file " + filename + " is corrupt").c_str());
+            }
+            if (!writable && !table->header->is_complete) {
+                continue;
+            }
+            m_tables[my][their] = std::move(table);
+        }
+    }
+}
+
+Tablebase::~Tablebase()
+{
+}
+
+
+void Tablebase::generate_class(int num_my_pawns, int num_their_pawns, unsigned int num_threads)
+{
+    ClassTable& table = *m_tables[num_my_pawns][num_their_pawns];
+    if (table.header->is_complete) {
+        return;
+    }
+
+    WorkStealingPool pool(num_threads);
+    std::uint64_t num_positions = table.header->num_positions;
+    std::uint64_t num_tasks = std::min<std::uint64_t>(pool.num_threads()*TASKS_PER_THREAD, num_positions);
+    std::uint64_t num_their_ranks = binomial(NUM_SQUARES - num_my_pawns, num_their_pawns);
+    for (std::uint64_t task = 0; task < num_tasks; ++task) {
+        std::uint64_t begin = num_positions*task/num_tasks;
+        std::uint64_t end = num_positions*(task + 1)/num_tasks;
+        pool.add_task([=, &table](unsigned int) {
+            for (std::uint64_t index = begin; index < end; ++index) {
+                if (table.get(index) != 0) {
+                    // Solved already, as part of another position or before the generator was interrupted
+                    continue;
+                }
+                Bitboard my_squares = unrank_squares(index/num_their_ranks, num_my_pawns);
+                Bitboard their_squares = expand_squares(unrank_squares(index%num_their_ranks, num_their_pawns),
+                                                        my_squares);
+                solve({my_squares << FIRST_SQUARE, their_squares << FIRST_SQUARE});
+            }
+        });
+    }
+    pool.run();
+
+    table.region.flush();
+    table.header->is_complete = 1;
+    table.region.flush();
+}
+
+bool Tablebase::is_complete(int num_my_pawns, int num_their_pawns) const
+{
+    const ClassTable* table = m_tables[num_my_pawns][num_their_pawns].get();
+    return table && table->header->is_complete;
+}
+
+std::uint64_t Tablebase::num_positions(int num_my_pawns, int num_their_pawns) const
+{
+    return binomial(NUM_SQUARES, num_my_pawns) * binomial(NUM_SQUARES - num_my_pawns, num_their_pawns);
+}
+
+
+bool Tablebase::probe(const Position& pos, int& score) const
+{
+    std::uint64_t index;
+    const ClassTable* table = find_table(pos, index);
+    if (!table) {
+        return false;
+    }
+    int code = table->get(index);
+    if (code == 0) {
+        return false;
+    }
+    score = code - 2;
+    return true;
+}
+
+
+// Returns null if the position isn't one that gets stored
+Tablebase::ClassTable* Tablebase::find_table(const Position& pos, std::uint64_t& index) const
+{
+    // This also turns away positions with an en passant square, whose marker is on their_pawns' rank 8
+    const Bitboard EDGE_RANKS = 0xff00'0000'0000'00ffULL;
+    if ((pos.my_pawns | pos.their_pawns) & EDGE_RANKS) {
+        return nullptr;
+    }
+    int num_my_pawns = popcount(pos.my_pawns);
+    int num_their_pawns = popcount(pos.their_pawns);
+    if (num_my_pawns > m_max_pawns || num_their_pawns > m_max_pawns) {
+        return nullptr;
+    }
+    ClassTable* table = m_tables[num_my_pawns][num_their_pawns].get();
+    if (!table) {
+        return nullptr;
+    }
+    Bitboard my_squares = pos.my_pawns >> FIRST_SQUARE;
+    Bitboard their_squares = compress_squares(pos.their_pawns >> FIRST_SQUARE, my_squares);
+    index = rank_squares(my_squares)*binomial(NUM_SQUARES - num_my_pawns, num_their_pawns)
+          + rank_squares(their_squares);
+    return table;
+}
+
+// Works out the score by searching the position's children, stopping at any that are already in the table.
+// Pawns never move backward, so this never loops, and nothing gets solved twice.
+// Every child of a position in the tablebase is in it too (or is an en passant position whose children are),
+// since flipping the board swaps the pawn counts and a capture only takes one away.
+int Tablebase::solve(const Position& pos)
+{
+    if (!pos.my_pawns || pos.their_pawns & RANK_1) {
+        return -1;
+    }
+
+    std::uint64_t index = 0;
+    ClassTable* table = find_table(pos, index);
+    if (table) {
+        int code = table->get(index);
+        if (code != 0) {
+            return code - 2;
+        }
+    }
+
+    MoveList movelist;
+    gen_moves(movelist, pos);
+    int score = movelist.empty() ? 0 : -1;            // stalemate is a draw
+    for (const SearchMove& move : movelist) {
+        score = std::max(score, -solve(flip_board(move.new_pos)));
+        if (score == 1) {
+            break;
+        }
+    }
+
+    if (table) {
+        table->set(index, score + 2);
+    }
+    return score;
+}
+
+
+namespace
+{
+
+std::uint64_t binomial(unsigned int n, unsigned int k)
+{
+    static const auto table = [] {
+        std::array<std::array<std::uint64_t, Tablebase::MAX_PAWNS + 1>, NUM_SQUARES + 1> result = {};
+        for (unsigned int i = 0; i <= NUM_SQUARES; ++i) {
+            result[i][0] = 1;
+            for (unsigned int j = 1; j <= Tablebase::MAX_PAWNS && j <= i; ++j) {
+                result[i][j] = result[i - 1][j - 1] + (j < i ? result[i - 1][j] : 0);
+            }
+        }
+        return result;
+    }();
+    return k <= n ? table[n][k] : 0;
+}
+
+// The rank of a set of squares among all sets of the same size (the combinatorial number system):
+// the sum of binomial(square, i + 1) over the squares in increasing order
+std::uint64_t rank_squares(Bitboard squares)
+{
+    std::uint64_t rank = 0;
+    for (unsigned int i = 0; squares; squares &= squares - 1, ++i) {
+        rank += binomial(lowest_bitnum(squares), i + 1);
+    }
+    return rank;
+}
+
+Bitboard unrank_squares(std::uint64_t rank, int num_squares)
+{
+    Bitboard squares = 0;
+    unsigned int square = NUM_SQUARES;
+    for (int i = num_squares; i > 0; --i) {
+        // Find the highest square that keeps the rank in range
+        do {
+            --square;
+        } while (binomial(square, i) > rank);
+        rank -= binomial(square, i);
+        squares |= 1ULL << square;
+    }
+    return squares;
+}
+
+// Closes up the gaps the removed squares leave, so the remaining squares can be ranked among themselves
+Bitboard compress_squares(Bitboard squares, Bitboard removed)
+{
+    Bitboard result = 0;
+    for (; squares; squares &= squares - 1) {
+        unsigned int square = lowest_bitnum(squares);
+        result |= 1ULL << (square - popcount(removed & ((1ULL << square) - 1)));
+    }
+    return result;
+}
+
+// Undoes compress_squares
+Bitboard expand_squares(Bitboard squares, Bitboard removed)
+{
+    Bitboard result = 0;
+    unsigned int compressed = 0;
+    for (unsigned int square = 0; squares >> compressed; ++square) {
+        if (removed & (1ULL << square)) {
+            continue;
+        }
+        if (squares & (1ULL << compressed)) {
+            result |= 1ULL << square;
+        }
+        ++compressed;
+    }
+    return result;
+}
+
+std::string class_filename(const std::string& directory, int num_my_pawns, int num_their_pawns)
+{
+    std::ostringstream filename;
+    filename << directory << "/" << num_my_pawns << "v" << num_their_pawns << ".ptb";
+    return filename.str();
+}
+
+} // anon namespace
@@ -0,0 +1,49 @@
+#ifndef PEASANT_TABLEBASE_HPP
+#define PEASANT_TABLEBASE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "position.hpp"
+
+// Endgame tablebases: the exact score of every position with up to max_pawns pawns per side.
+//
+// Positions are grouped into classes by how many pawns each side has, and each class is a file
+// in the tablebase directory. A position's score takes 2 bits (0 = not solved yet, 1 = loss, 2 = draw, 3 = win),
+// at an index computed from its pawns' squares, so the files hold nothing else but a small header.
+// Positions with an en passant square, or with a pawn on its first or last rank, aren't stored;
+// the search works those out from their children.
+//
+// The files are memory-mapped, and scores are written straight into the mapping as they're found,
+// so an interrupted generation picks up where it left off.
+class Tablebase
+{
+public:
+    static constexpr int MAX_PAWNS = 8;
+
+    // If writable, any missing files are created, ready to be generated; otherwise only complete files are used
+    Tablebase(const std::string& directory, int max_pawns, bool writable);
+    ~Tablebase();
+
+    // Solves every position of a class. The class's positions are split among the threads,
+    // and they share whatever each other have solved.
+    void generate_class(int num_my_pawns, int num_their_pawns, unsigned int num_threads);
+    bool is_complete(int num_my_pawns, int num_their_pawns) const;
+    std::uint64_t num_positions(int num_my_pawns, int num_their_pawns) const;
+    int max_pawns() const { return m_max_pawns; }
+
+    // Returns false if the position isn't in the tablebase
+    bool probe(const Position& pos, int& score) const;
+
+private:
+    struct ClassTable;
+
+    ClassTable* find_table(const Position& pos, std::uint64_t& index) const;
+    int solve(const Position& pos);
+
+    int m_max_pawns;
+    std::unique_ptr<ClassTable> m_tables[MAX_PAWNS + 1][MAX_PAWNS + 1];     // [my pawns][their pawns]
+};
+
+#endif
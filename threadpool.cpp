@@ -0,0 +1,85 @@
+#include <algorithm>
+#include <exception>
+#include <thread>
+#include "threadpool.hpp"
+
+WorkStealingPool::WorkStealingPool(unsigned int num_threads)
+  : m_next_queue(0)
+{
+    for (unsigned int i = 0; i < std::max(num_threads, 1u); ++i) {
+        m_queues.push_back(std::make_unique<TaskQueue>());
+    }
+}
+
+// Tasks are dealt out to the threads round-robin. Must not be called while run() is running.
+void WorkStealingPool::add_task(Task task)
+{
+    m_queues[m_next_queue]->tasks.push_back(std::move(task));
+    m_next_queue = (m_next_queue + 1) % m_queues.size();
+}
+
+// Blocks until every task has been run. The calling thread does its share of the work.
+// If a task throws, the first exception is rethrown here once all threads have stopped.
+void WorkStealingPool::run()
+{
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto guarded_work = [&](unsigned int thread_index) {
+        try {
+            work(thread_index);
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < num_threads(); ++i) {
+        threads.emplace_back(guarded_work, i);
+    }
+    guarded_work(0);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void WorkStealingPool::work(unsigned int thread_index)
+{
+    Task task;
+    while (take_task(thread_index, task)) {
+        task(thread_index);
+    }
+}
+
+// No tasks are added while the pool runs, so once every deque is empty, we're done
+bool WorkStealingPool::take_task(unsigned int thread_index, Task& task)
+{
+    {
+        TaskQueue& own = *m_queues[thread_index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+
+    for (unsigned int i = 1; i < num_threads(); ++i) {
+        TaskQueue& victim = *m_queues[(thread_index + i) % num_threads()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
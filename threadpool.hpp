@@ -0,0 +1,37 @@
+#ifndef PEASANT_THREADPOOL_HPP
+#define PEASANT_THREADPOOL_HPP
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Runs a fixed set of tasks on several threads.
+// Each thread has its own deque of tasks. It takes tasks from the back of its own deque,
+// and when that runs dry, it steals from the front of the other threads' deques.
+class WorkStealingPool
+{
+public:
+    typedef std::function<void(unsigned int thread_index)> Task;
+
+    explicit WorkStealingPool(unsigned int num_threads);
+    void add_task(Task task);
+    void run();
+    unsigned int num_threads() const { return static_cast<unsigned int>(m_queues.size()); }
+
+private:
+    struct TaskQueue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void work(unsigned int thread_index);
+    bool take_task(unsigned int thread_index, Task& task);
+
+    std::vector<std::unique_ptr<TaskQueue>> m_queues;
+    std::size_t m_next_queue;
+};
+
+#endif
@@ -1,87 +1,264 @@
-#include <random>
+#include <algorithm>
 #include <cassert>
+#include <climits>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
 #include "tt.hpp"
 
-namespace
+
+TranspositionTable::TranspositionTable(std::size_t num_buckets)
+  : m_buckets(num_buckets)
+{
+}
+
+// Overwrites the position's own slot if it's in the bucket already; otherwise replaces the shallowest entry.
+// Returns true if that evicted some other position's entry.
+bool TranspositionTable::insert(std::uint64_t hash, const TTEntry& entry)
+{
+    if (m_buckets.size() == 0) {
+        return false;
+    }
+    TTBucket& bucket = m_buckets[get_bucket_index(hash)];
+    // Another thread may be writing the bucket, but a torn slot only makes for a poor choice of slot
+    std::size_t victim = 0;
+    int victim_depth = INT_MAX;
+    for (std::size_t i = 0; i < SLOTS_PER_BUCKET; ++i) {
+        TTEntry slot_entry;
+        if (read_slot(bucket.slots[i], hash, slot_entry)) {
+            victim = i;
+            victim_depth = -1;                  // nobody else's entry
+            break;
+        }
+        slot_entry = unpack_entry(bucket.slots[i].data.load(std::memory_order_relaxed));
+        if (slot_entry.depth < victim_depth) {
+            victim = i;
+            victim_depth = slot_entry.depth;
+        }
+    }
+    std::uint64_t data = pack_entry(entry);
+    bucket.slots[victim].checked_hash.store(hash ^ data, std::memory_order_relaxed);
+    bucket.slots[victim].data.store(data, std::memory_order_relaxed);
+    return victim_depth >= 0;
+}
+
+bool TranspositionTable::fetch(std::uint64_t hash, TTEntry& entry) const
 {
-std::uint64_t g_zobrist_codes[8][0x10000];
-std::uint64_t g_zobrist_en_passant[64];
+    if (m_buckets.size() == 0) {
+        return false;
+    }
+    const TTBucket& bucket = m_buckets[get_bucket_index(hash)];
+    for (const TTSlot& slot : bucket.slots) {
+        if (read_slot(slot, hash, entry)) {
+            return true;
+        }
+    }
+    return false;
 }
 
 
-TranspositionTable::TranspositionTable(std::size_t num_buckets, std::size_t num_slots_per_bucket)
-  : m_entries(num_buckets*num_slots_per_bucket),
-    m_num_slots_per_bucket(num_slots_per_bucket)
+std::size_t TranspositionTable::get_bucket_index(std::uint64_t hash) const
 {
+    return hash % m_buckets.size();
 }
 
-void TranspositionTable::insert(std::uint64_t hash, const TTEntry& entry)
+// True if every slot in the hash's bucket holds a valid entry (for statistics)
+bool TranspositionTable::is_bucket_full(std::uint64_t hash) const
 {
-    assert(hash == calc_hash(entry.pos));
-    if (m_entries.size() == 0) {
-        return;
+    if (m_buckets.size() == 0) {
+        return false;
     }
-    std::uint64_t index = get_bucket_index(hash);
-    std::size_t last_index = index + m_num_slots_per_bucket - 1;
-    for (; index <= last_index; ++index) {
-        if (entry.depth > m_entries[index].depth || index == last_index) {
-            m_entries[index] = entry;
-            return;
-        } 
+    for (const TTSlot& slot : m_buckets[get_bucket_index(hash)].slots) {
+        if (unpack_entry(slot.data.load(std::memory_order_relaxed)).depth < 0) {
+            return false;
+        }
     }
+    return true;
 }
 
-const TTEntry* TranspositionTable::fetch(std::uint64_t hash, const Position& pos) const
+// The fraction of slots holding valid entries, estimated from the first few thousand buckets
+double TranspositionTable::occupancy() const
 {
-    assert(hash == calc_hash(pos));
-    if (m_entries.size() == 0) {
-        return nullptr;
+    const std::size_t num_sampled = std::min<std::size_t>(m_buckets.size(), 0x1000);
+    if (num_sampled == 0) {
+        return 0;
     }
-    // @TODO@ -- duplicate code
-    std::size_t index = get_bucket_index(hash);
-    for (std::size_t i = 0; i < m_num_slots_per_bucket; ++i) {
-        if (m_entries[index].depth > 0 && m_entries[index].pos == pos) {
-            return &m_entries[index];
+    std::size_t num_used = 0;
+    for (std::size_t i = 0; i < num_sampled; ++i) {
+        for (const TTSlot& slot : m_buckets[i].slots) {
+            num_used += unpack_entry(slot.data.load(std::memory_order_relaxed)).depth >= 0;
         }
     }
-    return nullptr;
+    return double(num_used) / (num_sampled * SLOTS_PER_BUCKET);
 }
 
 
-std::size_t TranspositionTable::get_bucket_index(std::uint64_t hash) const
+// Streamed a chunk at a time, so that neither needs a second copy of the table in memory
+void TranspositionTable::save(std::ostream& out) const
 {
-    return hash % (m_entries.size()/m_num_slots_per_bucket) * m_num_slots_per_bucket;
+    std::vector<std::uint64_t> words;
+    for (std::size_t first = 0; first < m_buckets.size(); first += CHECKPOINT_CHUNK_BUCKETS) {
+        std::size_t last = std::min(m_buckets.size(), first + CHECKPOINT_CHUNK_BUCKETS);
+        words.clear();
+        for (std::size_t i = first; i < last; ++i) {
+            for (const TTSlot& slot : m_buckets[i].slots) {
+                words.push_back(slot.checked_hash.load(std::memory_order_relaxed));
+                words.push_back(slot.data.load(std::memory_order_relaxed));
+            }
+        }
+        out.write(reinterpret_cast<const char*>(words.data()), words.size() * sizeof(std::uint64_t));
+    }
 }
 
-
-// Call this at program start
-void init_zobrist()
+// The table has to be the same size as the one that was saved
+void TranspositionTable::load(std::istream& in)
 {
-    std::mt19937_64 rng;
-    for (int i = 0; i < 8; ++i) {
-        for (int j = 0; j < 0x10000; ++j) {
-            g_zobrist_codes[i][j] = rng();
+    std::vector<std::uint64_t> words;
+    for (std::size_t first = 0; first < m_buckets.size(); first += CHECKPOINT_CHUNK_BUCKETS) {
+        std::size_t last = std::min(m_buckets.size(), first + CHECKPOINT_CHUNK_BUCKETS);
+        words.resize((last - first) * SLOTS_PER_BUCKET * 2);
+        if (!in.read(reinterpret_cast<char*>(words.data()), words.size() * sizeof(std::uint64_t))) {
+            throw std::runtime_error("Transposition table checkpoint is truncated");
         }
+        const std::uint64_t* word = words.data();
+        for (std::size_t i = first; i < last; ++i) {
+            for (TTSlot& slot : m_buckets[i].slots) {
+                slot.checked_hash.store(*word++, std::memory_order_relaxed);
+                slot.data.store(*word++, std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+
+// Layout, low bits first: lower bound, upper bound (2 bits each, stored as score + 1),
+// then depth + 1 (16 bits), so that an all-zero slot holds an invalid entry,
+// then whether there's a best move (1 bit) and its source and destination squares (6 bits each)
+std::uint64_t TranspositionTable::pack_entry(const TTEntry& entry)
+{
+    assert(entry.depth >= -1 && entry.depth <= TTEntry::PROVEN_DEPTH);
+    std::uint64_t data = std::uint64_t(entry.lower_bound + 1)
+                       | std::uint64_t(entry.upper_bound + 1) << 2
+                       | std::uint64_t(entry.depth + 1) << 4;
+    if (entry.best_move) {
+        data |= 1ULL << 20
+              | std::uint64_t(entry.best_move->src_bitnum) << 21
+              | std::uint64_t(entry.best_move->dest_bitnum) << 27;
+    }
+    return data;
+}
+
+TTEntry TranspositionTable::unpack_entry(std::uint64_t data)
+{
+    TTEntry entry;
+    entry.lower_bound = int(data & 3) - 1;
+    entry.upper_bound = int(data >> 2 & 3) - 1;
+    entry.depth = int(data >> 4 & 0xffff) - 1;
+    if (data >> 20 & 1) {
+        entry.best_move = to_move(unsigned(data >> 21 & 63), unsigned(data >> 27 & 63));
+    }
+    return entry;
+}
+
+// Returns false if the slot holds some other position, holds nothing, or was torn by concurrent writes
+bool TranspositionTable::read_slot(const TTSlot& slot, std::uint64_t hash, TTEntry& entry)
+{
+    std::uint64_t data = slot.data.load(std::memory_order_relaxed);
+    if ((slot.checked_hash.load(std::memory_order_relaxed) ^ data) != hash) {
+        return false;
     }
-    for (int i = 0; i < 64; ++i) {
-        g_zobrist_en_passant[i] = rng();
+    entry = unpack_entry(data);
+    return entry.depth >= 0;
+}
+
+
+PerftTable::PerftTable(std::size_t num_entries)
+  : m_entries(num_entries)
+{
+}
+
+// Always replaces whatever was in the slot
+void PerftTable::insert(std::uint64_t hash, int depth, std::uint64_t num_leaves)
+{
+    if (m_entries.size() == 0) {
+        return;
     }
+    std::uint64_t key = make_key(hash, depth);
+    PerftEntry& entry = m_entries[key % m_entries.size()];
+    entry.checked_key.store(key ^ num_leaves, std::memory_order_relaxed);
+    entry.num_leaves.store(num_leaves, std::memory_order_relaxed);
 }
 
+bool PerftTable::fetch(std::uint64_t hash, int depth, std::uint64_t& num_leaves) const
+{
+    if (m_entries.size() == 0) {
+        return false;
+    }
+    std::uint64_t key = make_key(hash, depth);
+    const PerftEntry& entry = m_entries[key % m_entries.size()];
+    std::uint64_t entry_leaves = entry.num_leaves.load(std::memory_order_relaxed);
+    if ((entry.checked_key.load(std::memory_order_relaxed) ^ entry_leaves) != key) {
+        return false;
+    }
+    num_leaves = entry_leaves;
+    return true;
+}
 
-std::uint64_t calc_hash(const Position& pos)
+// The same position has a different leaf count at each depth, so the depth has to be part of the key
+std::uint64_t PerftTable::make_key(std::uint64_t hash, int depth)
 {
-    Bitboard my_pawns = pos.my_pawns;
-    Bitboard their_pawns = pos.their_pawns;
-    // OK to use 0 in case of no en passant (0 is never a valid en passant square)
-    std::uint64_t hash = g_zobrist_en_passant[pos.en_passant_bitnum.value_or(0)];
-    hash ^= g_zobrist_codes[0][0xffff & my_pawns];
-    hash ^= g_zobrist_codes[1][0xffff & (my_pawns >> 16)];
-    hash ^= g_zobrist_codes[2][0xffff & (my_pawns >> 32)];
-    hash ^= g_zobrist_codes[3][0xffff & (my_pawns >> 48)];
-    hash ^= g_zobrist_codes[4][0xffff & their_pawns];
-    hash ^= g_zobrist_codes[5][0xffff & (their_pawns >> 16)];
-    hash ^= g_zobrist_codes[6][0xffff & (their_pawns >> 32)];
-    hash ^= g_zobrist_codes[7][0xffff & (their_pawns >> 48)];
-    return hash;
+    return hash ^ (depth * 0x9e37'79b9'7f4a'7c15ULL);
+}
+
+
+ProofTable::ProofTable(std::size_t num_buckets)
+  : m_buckets(num_buckets)
+{
+}
+
+// Overwrites the key's own slot if it's in the bucket already; otherwise replaces the entry with the least work
+void ProofTable::insert(std::uint64_t key, std::uint32_t proof, std::uint32_t disproof, std::uint64_t work)
+{
+    assert(proof <= INFINITE && disproof <= INFINITE);
+    if (m_buckets.size() == 0) {
+        return;
+    }
+    ProofBucket& bucket = m_buckets[key % m_buckets.size()];
+    std::size_t victim = 0;
+    std::uint64_t victim_work = UINT64_MAX;
+    for (std::size_t i = 0; i < SLOTS_PER_BUCKET; ++i) {
+        std::uint64_t data = bucket.slots[i].data.load(std::memory_order_relaxed);
+        if ((bucket.slots[i].checked_key.load(std::memory_order_relaxed) ^ data) == key) {
+            victim = i;
+            break;
+        }
+        // An empty slot has zero work, so it's the first to go
+        if ((data >> 56) < victim_work) {
+            victim = i;
+            victim_work = data >> 56;
+        }
+    }
+    std::uint64_t work_log = 0;
+    for (; work >> work_log; ++work_log) {
+    }
+    std::uint64_t data = std::uint64_t(proof) | std::uint64_t(disproof) << 28 | work_log << 56;
+    bucket.slots[victim].checked_key.store(key ^ data, std::memory_order_relaxed);
+    bucket.slots[victim].data.store(data, std::memory_order_relaxed);
+}
+
+bool ProofTable::fetch(std::uint64_t key, std::uint32_t& proof, std::uint32_t& disproof) const
+{
+    if (m_buckets.size() == 0) {
+        return false;
+    }
+    const ProofBucket& bucket = m_buckets[key % m_buckets.size()];
+    for (const ProofSlot& slot : bucket.slots) {
+        std::uint64_t data = slot.data.load(std::memory_order_relaxed);
+        if ((slot.checked_key.load(std::memory_order_relaxed) ^ data) == key && data != 0) {
+            proof = data & INFINITE;
+            disproof = (data >> 28) & INFINITE;
+            return true;
+        }
+    }
+    return false;
 }
@@ -1,51 +1,153 @@
 #ifndef PEASANT_TT_HPP
 #define PEASANT_TT_HPP
 
+#include <atomic>
+#include <iosfwd>
+#include <optional>
 #include <vector>
+#include "hash.hpp"
 #include "position.hpp"
 
-// TODO: make this as space-efficient as possible, probably
+// What the table knows about a position: bounds on its game-theoretic score and how deep it was searched.
+// The bounds are true whatever the depth, since the search treats positions past its horizon as unknown.
+// lower_bound == upper_bound means the score is exact (and thus proven); lower_bound == -1 means the
+// entry is only an upper bound, and upper_bound == 1 means it's only a lower bound.
+// best_move is the move that was best (or good enough for a cutoff) when the position was last searched,
+// to be searched first next time. It's for the position whose hash is the canonical one,
+// so a position that's the mirror of that one has to mirror it.
+// In the table itself, this gets packed into 64 bits.
 struct TTEntry
 {
+    // Proven results are stored at this depth so that they cut off at any depth
+    // and are the last to be replaced
+    static const int PROVEN_DEPTH = 0xfffe;
+
     TTEntry()
       : depth(-1)
     {
     }
 
-    TTEntry(const Position& _pos, int _alpha, int _beta, int _lower_bound, int _upper_bound, int _depth)
-      : pos(_pos),
-        alpha(_alpha),
-        beta(_beta),
-        lower_bound(_lower_bound),
+    TTEntry(int _lower_bound, int _upper_bound, int _depth, std::optional<Move> _best_move = {})
+      : lower_bound(_lower_bound),
         upper_bound(_upper_bound),
-        depth(_depth)
+        depth(_lower_bound == _upper_bound ? PROVEN_DEPTH : _depth),
+        best_move(_best_move)
     {
     }
 
-    Position pos;
-    int alpha;
-    int beta;
+    bool is_proven() const { return lower_bound == upper_bound; }
+
     int lower_bound;
     int upper_bound;
     int depth;                                  // <0 means invalid entry
+    std::optional<Move> best_move;
 };
 
 
+// Each slot is 16 bytes: the packed entry, and the hash XORed with the packed entry.
+// The position itself isn't stored; the full 64-bit hash is trusted to tell positions apart.
+// Several search threads may share the table without locks. A slot torn by two threads
+// writing it at once won't match any hash, so it just looks like a miss.
 class TranspositionTable
 {
 public:
-    TranspositionTable(std::size_t num_buckets, std::size_t num_slots_per_bucket);
-    void insert(std::uint64_t hash, const TTEntry& entry);
-    const TTEntry* fetch(std::uint64_t hash, const Position& pos) const;
+    explicit TranspositionTable(std::size_t num_buckets);
+    bool insert(std::uint64_t hash, const TTEntry& entry);
+    bool fetch(std::uint64_t hash, TTEntry& entry) const;
     std::size_t get_bucket_index(std::uint64_t hash) const;
+    bool is_bucket_full(std::uint64_t hash) const;
+    double occupancy() const;
+    std::size_t num_buckets() const { return m_buckets.size(); }
+    bool is_enabled() const { return !m_buckets.empty(); }
+
+    // The slots as raw words, for checkpoints. save can run while other threads search;
+    // a slot written during the save just comes back as a miss.
+    void save(std::ostream& out) const;
+    void load(std::istream& in);
+
+    static const std::size_t SLOTS_PER_BUCKET = 4;
 
 private:
-    std::vector<TTEntry> m_entries;
-    std::size_t m_num_slots_per_bucket;
+    static const std::size_t CHECKPOINT_CHUNK_BUCKETS = 0x4000;    // 1 MiB
+
+    struct TTSlot
+    {
+        std::atomic<std::uint64_t> checked_hash;
+        std::atomic<std::uint64_t> data;
+    };
+
+    // A bucket fills exactly one cache line, so a probe touches only one line
+    struct alignas(64) TTBucket
+    {
+        TTSlot slots[SLOTS_PER_BUCKET];
+    };
+    static_assert(sizeof(TTBucket) == 64, "a bucket should fill one cache line");
+
+    static std::uint64_t pack_entry(const TTEntry& entry);
+    static TTEntry unpack_entry(std::uint64_t data);
+    static bool read_slot(const TTSlot& slot, std::uint64_t hash, TTEntry& entry);
+
+    std::vector<TTBucket> m_buckets;
+};
+
+
+// Counts of perft leaves, for when the same subtree is reached by more than one path.
+// Several threads may share the table without locks. The key is stored XORed with the leaf count,
+// so if two threads write the same entry at once, the mismatched halves won't look like a valid entry.
+struct PerftEntry
+{
+    std::atomic<std::uint64_t> checked_key;     // the position's hash mixed with its depth, XOR num_leaves
+    std::atomic<std::uint64_t> num_leaves;
 };
 
 
-void init_zobrist();
-std::uint64_t calc_hash(const Position& pos);
+class PerftTable
+{
+public:
+    explicit PerftTable(std::size_t num_entries);
+    void insert(std::uint64_t hash, int depth, std::uint64_t num_leaves);
+    bool fetch(std::uint64_t hash, int depth, std::uint64_t& num_leaves) const;
+    bool is_enabled() const { return !m_entries.empty(); }
+
+private:
+    static std::uint64_t make_key(std::uint64_t hash, int depth);
+
+    std::vector<PerftEntry> m_entries;
+};
+
+
+// Proof and disproof numbers for df-pn, for positions whose proofs are still in progress
+// (finished proofs go into the TranspositionTable as bounds). The key has to say which threshold
+// is being proven, since the same position gets asked about more than one.
+// Like the TranspositionTable, it's made of cache-line buckets of 16-byte slots checked by XOR,
+// and it's what keeps df-pn's memory use bounded: when a bucket is full, the entry that took
+// the least work to find gets replaced.
+class ProofTable
+{
+public:
+    // Proof numbers saturate here; a proof number this big means the node is disproven, and vice versa
+    static const std::uint32_t INFINITE = 0x0fff'ffff;
+
+    explicit ProofTable(std::size_t num_buckets);
+    void insert(std::uint64_t key, std::uint32_t proof, std::uint32_t disproof, std::uint64_t work);
+    bool fetch(std::uint64_t key, std::uint32_t& proof, std::uint32_t& disproof) const;
+
+    static const std::size_t SLOTS_PER_BUCKET = 4;
+
+private:
+    struct ProofSlot
+    {
+        std::atomic<std::uint64_t> checked_key;
+        std::atomic<std::uint64_t> data;        // proof (28 bits), disproof (28 bits), log2 of work (8 bits)
+    };
+
+    struct alignas(64) ProofBucket
+    {
+        ProofSlot slots[SLOTS_PER_BUCKET];
+    };
+    static_assert(sizeof(ProofBucket) == 64, "a bucket should fill one cache line");
+
+    std::vector<ProofBucket> m_buckets;
+};
 
 #endif
@@ -0,0 +1,390 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include "movegen.hpp"
+#include "threadpool.hpp"
+#include "unique_perft.hpp"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+// A position as it's sorted and stored on disk: the same two bitboards as Position, plus an order
+struct PackedPosition
+{
+    Bitboard my_pawns;
+    Bitboard their_pawns;
+
+    bool operator<(const PackedPosition& rhs) const {
+        return my_pawns < rhs.my_pawns || (my_pawns == rhs.my_pawns && their_pawns < rhs.their_pawns);
+    }
+    bool operator==(const PackedPosition& rhs) const {
+        return my_pawns == rhs.my_pawns && their_pawns == rhs.their_pawns;
+    }
+    bool operator!=(const PackedPosition& rhs) const { return !(*this == rhs); }
+};
+
+// Frontier positions are handed out to the threads this many at a time
+const std::size_t CHUNK_POSITIONS = 0x1'0000;
+// Runs on disk are read and written this many positions at a time
+const std::size_t IO_BLOCK_POSITIONS = 0x1'0000;
+
+// How much memory the buffers and frontiers hold, and the most they've held since the last reset
+class MemoryMeter
+{
+public:
+    void add(std::size_t bytes)
+    {
+        std::size_t now = m_current += bytes;
+        std::size_t peak = m_peak.load();
+        while (now > peak && !m_peak.compare_exchange_weak(peak, now)) {
+        }
+    }
+    void remove(std::size_t bytes) { m_current -= bytes; }
+    void reset_peak() { m_peak = m_current.load(); }
+    std::size_t peak() const { return m_peak; }
+
+private:
+    std::atomic<std::size_t> m_current = 0;
+    std::atomic<std::size_t> m_peak = 0;
+};
+
+// A ply's distinct positions, in order, in memory or in a file
+struct Frontier
+{
+    std::vector<PackedPosition> positions;          // if not on disk
+    fs::path file;                                  // empty if in memory
+    std::uint64_t size = 0;
+};
+
+// One sorted run being merged, from memory or from disk
+class RunReader
+{
+public:
+    RunReader(const std::vector<PackedPosition>& positions);
+    RunReader(const fs::path& file, std::size_t block_size, MemoryMeter& meter);
+    ~RunReader();
+    bool is_done() const { return m_next == m_end; }
+    const PackedPosition& current() const { return *m_next; }
+    void advance();
+
+private:
+    void fill();
+
+    std::ifstream m_in;
+    std::vector<PackedPosition> m_block;
+    const PackedPosition* m_next;
+    const PackedPosition* m_end;
+    MemoryMeter* m_meter;
+};
+
+PackedPosition pack_position(const Position& pos);
+Position unpack_position(const PackedPosition& packed);
+void sort_unique(std::vector<PackedPosition>& positions);
+void write_positions(const fs::path& file, const std::vector<PackedPosition>& positions);
+void read_chunk(const Frontier& frontier, std::uint64_t first, std::size_t count, std::vector<PackedPosition>& chunk);
+Frontier merge_runs(std::vector<std::vector<PackedPosition>>& memory_runs,
+                    const std::vector<fs::path>& disk_runs,
+                    const fs::path& output,
+                    std::size_t block_size,
+                    MemoryMeter& meter);
+fs::path make_spill_directory(const std::string& parent);
+}
+
+
+void unique_perft(const Position& pos,
+                  int max_ply,
+                  const UniquePerftOptions& options,
+                  const std::function<void(const UniquePlyStats&)>& report)
+{
+    WorkStealingPool pool(options.num_threads);
+    // Half the memory is for the threads' buffers; a frontier that would take more than the other half goes to disk
+    std::size_t buffer_capacity = std::max<std::size_t>(options.memory_bytes / 2 / pool.num_threads() / sizeof(PackedPosition),
+                                                        IO_BLOCK_POSITIONS);
+    fs::path spill_directory = make_spill_directory(options.spill_directory);
+    MemoryMeter meter;
+
+    Frontier frontier;
+    frontier.positions.push_back(pack_position(pos));
+    frontier.size = 1;
+    meter.add(sizeof(PackedPosition));
+
+    try {
+        for (int ply = 1; ply <= max_ply && frontier.size > 0; ++ply) {
+            auto before = std::chrono::steady_clock::now();
+            meter.reset_peak();
+
+            std::vector<std::vector<PackedPosition>> buffers(pool.num_threads());
+            std::vector<std::uint64_t> thread_generated(pool.num_threads());
+            std::vector<fs::path> disk_runs;
+            std::mutex disk_runs_mutex;
+            std::atomic<std::size_t> next_run(0);
+            for (std::uint64_t first = 0; first < frontier.size; first += CHUNK_POSITIONS) {
+                pool.add_task([&, first](unsigned int thread_index) {
+                    std::vector<PackedPosition>& buffer = buffers[thread_index];
+                    std::vector<PackedPosition> chunk;
+                    std::size_t count = static_cast<std::size_t>(std::min<std::uint64_t>(CHUNK_POSITIONS, frontier.size - first));
+                    read_chunk(frontier, first, count, chunk);
+
+                    for (const PackedPosition& packed : chunk) {
+                        MoveList movelist;
+                        gen_moves(movelist, unpack_position(packed));
+                        thread_generated[thread_index] += movelist.size();
+                        for (const SearchMove& move : movelist) {
+                            if (buffer.size() == buffer.capacity() && buffer.capacity() < buffer_capacity) {
+                                // Grown by hand, so that it stops at the capacity and the meter sees it
+                                std::size_t old_capacity = buffer.capacity();
+                                buffer.reserve(std::min(std::max<std::size_t>(2 * old_capacity, 0x400), buffer_capacity));
+                                meter.add((buffer.capacity() - old_capacity) * sizeof(PackedPosition));
+                            }
+                            if (buffer.size() == buffer_capacity) {
+                                sort_unique(buffer);
+                                if (buffer.size() > buffer_capacity / 2) {
+                                    // De-duplicating didn't make enough room, so this lot goes to disk
+                                    fs::path run = spill_directory / ("run_" + std::to_string(next_run++) + ".bin");
+                                    write_positions(run, buffer);
+                                    buffer.clear();
+                                    std::lock_guard<std::mutex> lock(disk_runs_mutex);
+                                    disk_runs.push_back(run);
+                                }
+                            }
+                            buffer.push_back(pack_position(flip_board(move.new_pos)));
+                        }
+                    }
+                });
+            }
+            pool.run();
+
+            std::uint64_t num_generated = 0;
+            for (std::uint64_t generated : thread_generated) {
+                num_generated += generated;
+            }
+            // The buffers' last sorts are most of a ply's work when nothing spills, so they're spread over the threads too
+            for (std::vector<PackedPosition>& buffer : buffers) {
+                pool.add_task([&buffer](unsigned int) {
+                    sort_unique(buffer);
+                });
+            }
+            pool.run();
+
+            // The old frontier isn't needed once the next one is being made
+            if (!frontier.file.empty()) {
+                fs::remove(frontier.file);
+            }
+            meter.remove(frontier.positions.capacity() * sizeof(PackedPosition));
+            frontier = {};
+
+            fs::path output;
+            if (!disk_runs.empty()) {
+                output = spill_directory / ("ply_" + std::to_string(ply) + ".bin");
+            }
+            // The disk runs' read buffers share the other half of the memory
+            std::size_t block_size = std::clamp<std::size_t>(options.memory_bytes / 2 / std::max<std::size_t>(disk_runs.size(), 1) / sizeof(PackedPosition),
+                                                             0x400,
+                                                             IO_BLOCK_POSITIONS);
+            frontier = merge_runs(buffers, disk_runs, output, block_size, meter);
+            for (std::vector<PackedPosition>& buffer : buffers) {
+                meter.remove(buffer.capacity() * sizeof(PackedPosition));
+                buffer = {};
+            }
+            for (const fs::path& run : disk_runs) {
+                fs::remove(run);
+            }
+
+            std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - before;
+            report({ply, frontier.size, num_generated, disk_runs.size(), meter.peak(), seconds.count()});
+        }
+    }
+    catch (...) {
+        std::error_code ec;
+        fs::remove_all(spill_directory, ec);
+        throw;
+    }
+    fs::remove_all(spill_directory);
+}
+
+
+namespace
+{
+
+RunReader::RunReader(const std::vector<PackedPosition>& positions)
+  : m_next(positions.data()),
+    m_end(positions.data() + positions.size()),
+    m_meter(nullptr)
+{
+}
+
+RunReader::RunReader(const fs::path& file, std::size_t block_size, MemoryMeter& meter)
+  : m_in(file, std::ios::binary),
+    m_block(block_size),
+    m_meter(&meter)
+{
+    if (!m_in) {
+        throw std::runtime_error("Can't read " + file.string());
+    }
+    m_meter->add(m_block.size() * sizeof(PackedPosition));
+    fill();
+}
+
+RunReader::~RunReader()
+{
+    if (m_meter) {
+        m_meter->remove(m_block.size() * sizeof(PackedPosition));
+    }
+}
+
+void RunReader::advance()
+{
+    if (++m_next == m_end && m_in.is_open()) {
+        fill();
+    }
+}
+
+void RunReader::fill()
+{
+    m_in.read(reinterpret_cast<char*>(m_block.data()), m_block.size() * sizeof(PackedPosition));
+    std::size_t count = static_cast<std::size_t>(m_in.gcount()) / sizeof(PackedPosition);
+    m_next = m_block.data();
+    m_end = m_block.data() + count;
+}
+
+
+PackedPosition pack_position(const Position& pos)
+{
+    return {pos.my_pawns, pos.their_pawns};
+}
+
+Position unpack_position(const PackedPosition& packed)
+{
+    return {packed.my_pawns, packed.their_pawns};
+}
+
+
+void sort_unique(std::vector<PackedPosition>& positions)
+{
+    std::sort(positions.begin(), positions.end());
+    positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+}
+
+
+void write_positions(const fs::path& file, const std::vector<PackedPosition>& positions)
+{
+    std::ofstream out(file, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(positions.data()), positions.size() * sizeof(PackedPosition));
+    out.close();
+    if (!out) {
+        throw std::runtime_error("Can't write " + file.string());
+    }
+}
+
+
+void read_chunk(const Frontier& frontier, std::uint64_t first, std::size_t count, std::vector<PackedPosition>& chunk)
+{
+    if (frontier.file.empty()) {
+        chunk.assign(frontier.positions.begin() + first, frontier.positions.begin() + first + count);
+        return;
+    }
+    chunk.resize(count);
+    std::ifstream in(frontier.file, std::ios::binary);
+    in.seekg(first * sizeof(PackedPosition));
+    if (!in.read(reinterpret_cast<char*>(chunk.data()), count * sizeof(PackedPosition))) {
+        throw std::runtime_error("Can't read " + frontier.file.string());
+    }
+}
+
+
+// Merges the sorted runs, dropping duplicates, into a file if output isn't empty and into memory if it is
+Frontier merge_runs(std::vector<std::vector<PackedPosition>>& memory_runs,
+                    const std::vector<fs::path>& disk_runs,
+                    const fs::path& output,
+                    std::size_t block_size,
+                    MemoryMeter& meter)
+{
+    std::vector<std::unique_ptr<RunReader>> readers;
+    for (const std::vector<PackedPosition>& run : memory_runs) {
+        readers.push_back(std::make_unique<RunReader>(run));
+    }
+    for (const fs::path& run : disk_runs) {
+        readers.push_back(std::make_unique<RunReader>(run, block_size, meter));
+    }
+
+    // The reader with the smallest current position is on top
+    auto is_after = [&readers](std::size_t a, std::size_t b) {
+        return readers[b]->current() < readers[a]->current();
+    };
+    std::priority_queue<std::size_t, std::vector<std::size_t>, decltype(is_after)> heap(is_after);
+    for (std::size_t i = 0; i < readers.size(); ++i) {
+        if (!readers[i]->is_done()) {
+            heap.push(i);
+        }
+    }
+
+    Frontier frontier;
+    frontier.file = output;
+    std::ofstream out;
+    std::vector<PackedPosition> block;
+    if (!output.empty()) {
+        out.open(output, std::ios::binary);
+        block.reserve(IO_BLOCK_POSITIONS);
+        meter.add(block.capacity() * sizeof(PackedPosition));
+    }
+    std::vector<PackedPosition>& destination = output.empty() ? frontier.positions : block;
+    std::size_t destination_capacity = destination.capacity();
+
+    std::optional<PackedPosition> last;
+    while (!heap.empty()) {
+        std::size_t i = heap.top();
+        heap.pop();
+        PackedPosition packed = readers[i]->current();
+        readers[i]->advance();
+        if (!readers[i]->is_done()) {
+            heap.push(i);
+        }
+        if (last && *last == packed) {
+            continue;
+        }
+        last = packed;
+        ++frontier.size;
+        destination.push_back(packed);
+        if (!output.empty() && block.size() == IO_BLOCK_POSITIONS) {
+            out.write(reinterpret_cast<const char*>(block.data()), block.size() * sizeof(PackedPosition));
+            block.clear();
+        }
+        if (destination.capacity() != destination_capacity) {
+            meter.add((destination.capacity() - destination_capacity) * sizeof(PackedPosition));
+            destination_capacity = destination.capacity();
+        }
+    }
+
+    if (!output.empty()) {
+        out.write(reinterpret_cast<const char*>(block.data()), block.size() * sizeof(PackedPosition));
+        out.close();
+        if (!out) {
+            throw std::runtime_error("Can't write " + output.string());
+        }
+        meter.remove(block.capacity() * sizeof(PackedPosition));
+    }
+    return frontier;
+}
+
+
+fs::path make_spill_directory(const std::string& parent)
+{
+    std::random_device random;
+    std::ostringstream name;
+    name << "peasants_unique_" << std::hex << random() << random();
+    fs::path directory = (parent.empty() ? fs::temp_directory_path() : fs::path(parent)) / name.str();
+    fs::create_directories(directory);
+    return directory;
+}
+
+} // anon namespace
@@ -0,0 +1,43 @@
+#ifndef PEASANT_UNIQUE_PERFT_HPP
+#define PEASANT_UNIQUE_PERFT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include "position.hpp"
+
+// Counting the distinct positions at each ply, rather than the paths to them as perft does.
+// The tree is expanded a ply at a time: every distinct position at one ply has its moves made,
+// and the children are sorted and de-duplicated into the next ply's frontier.
+// Moves are made exactly as perft makes them, so each ply's count is at most perft's.
+// Positions that are mirrors of each other count as different.
+//
+// Each thread collects children into its own buffer, sorting and de-duplicating it whenever it fills.
+// A buffer that's still too full afterwards is written to disk as a sorted run, and the runs are merged
+// at the end of the ply. If anything was spilled, the next frontier goes to disk as well.
+
+struct UniquePerftOptions
+{
+    std::size_t memory_bytes = 0x4000'0000;         // roughly what the buffers and frontier may take (1 GiB)
+    std::string spill_directory;                    // empty for the system's temporary directory
+    unsigned int num_threads = 1;
+};
+
+struct UniquePlyStats
+{
+    int ply;
+    std::uint64_t num_unique;
+    std::uint64_t num_generated;            // children of the last ply's unique positions, duplicates and all
+    std::size_t num_spilled_runs;
+    std::size_t peak_bytes;                 // the most the buffers and frontiers held at once
+    double seconds;
+};
+
+// report is called after each ply. Stops after max_ply, or at a ply with no positions.
+void unique_perft(const Position& pos,
+                  int max_ply,
+                  const UniquePerftOptions& options,
+                  const std::function<void(const UniquePlyStats&)>& report);
+
+#endif